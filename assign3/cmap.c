@@ -137,10 +137,8 @@ CMap *cmap_create(size_t valuesz, size_t capacity_hint, CleanupValueFn fn)
   assert(valuesz > 0);
   new->valuesz = valuesz;
   new->nbuckets = (capacity_hint > 0) ? capacity_hint : DEFAULT_CAPACITY;
-  new->buckets = malloc((new->nbuckets)*sizeof(void*));
+  new->buckets = calloc(new->nbuckets, sizeof(void*)); // all buckets start empty (NULL)
   assert(new->buckets);
-  for(int i = 0; i < new->nbuckets; i++) 
-    (new->buckets)[i] = NULL;
   new->fn = fn;
   new->nelems = 0;
 
@@ -12,9 +12,28 @@
 #include <assert.h>
 #include <string.h>
 #include <search.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 // a suggested value to use when given capacity_hint is 0
 #define DEFAULT_CAPACITY 16
+// inline capacity for cvec_create_inline when given 0
+#define DEFAULT_INLINE_CAPACITY 8
+// capacity is multiplied by this when a full vector grows
+#define DEFAULT_GROWTH 2.0
+// sorts hand ranges this small to insertion sort
+#define INSERTION_THRESHOLD 16
+// parallel sort/search give no thread fewer elements than this, so
+// vectors smaller than twice this stay on the calling thread
+#define PARALLEL_MIN_CHUNK (1 << 15)
+// a searching thread checks for an earlier match this often
+#define SEARCH_BLOCK 1024
 
 /* Type: struct CVectorImplementation
  * ----------------------------------
@@ -25,10 +44,31 @@ struct CVectorImplementation {
   void * elems;
   size_t  elemsz, capacity;
   int nelems;
+  double growth;
   CleanupElemFn fn;
+  size_t inline_capacity;   // elements that fit in inline_elems, 0 if none
+  char inline_elems[] __attribute__((aligned)); // storage in same block as struct
 };
 
 
+/* Type: struct CVectorIndexImplementation
+ * ---------------------------------------
+ * A read-only copy of a sorted CVector laid out in Eytzinger (BFS) order:
+ * the root of the implicit search tree is at position 1 and the children
+ * of position k are at 2k and 2k+1. A search walks down from the root,
+ * so the elements it visits early are packed together near the start,
+ * and the 16 great-great-grandchildren of k are contiguous so they can be
+ * prefetched together. Position 0 is unused. orig maps each position back
+ * to the element's index in the CVector.
+ */
+struct CVectorIndexImplementation {
+  char *elems;
+  int *orig;
+  int nelems;
+  size_t elemsz;
+  CompareFn cmp;
+};
+
 /* The NOT_YET_IMPLEMENTED macro is used as the body for all functions
  * to remind you about which operations you haven't yet implemented.
  * It will report a fatal error if a call is made to an not-yet-implemented
@@ -45,15 +85,73 @@ static void *get_nth(const CVector *cv, int index)
   return (void*)( (char*)(cv->elems) + index*cv->elemsz );
 }
 
-/* Helper to dynamically allocate array */
-static void checkCapacity(CVector *cv)
+/* Helper to test whether elements are in the struct's own inline storage,
+ * which is not a heap block of its own and so must never be passed to
+ * realloc, free or malloc_usable_size.
+ */
+static bool is_inline(const CVector *cv)
+{
+  return cv->inline_capacity > 0 && cv->elems == cv->inline_elems;
+}
+
+/* Helper to (re)allocate array to hold at least n elements. The allocator
+ * rounds each request up to its own block size, so capacity is set from
+ * the usable size of the block actually received, and a request that
+ * already fits in the current block needs no call to realloc at all.
+ * Elements outgrowing inline storage are copied out to a new heap block.
+ */
+static void resize(CVector *cv, size_t n)
+{
+  if (is_inline(cv)) {
+    if (n <= cv->inline_capacity) return;
+    void *heap = malloc(n*cv->elemsz);
+    assert(heap);
+    memcpy(heap, cv->elems, cv->nelems*cv->elemsz);
+    cv->elems = heap;
+    cv->capacity = malloc_usable_size(heap)/cv->elemsz;
+    return;
+  }
+  if (cv->elems && n <= malloc_usable_size(cv->elems)/cv->elemsz) {
+    cv->capacity = malloc_usable_size(cv->elems)/cv->elemsz;
+    return;
+  }
+  cv->elems = realloc(cv->elems, n*cv->elemsz);
+  assert(cv->elems); // assert successful allocation
+  cv->capacity = malloc_usable_size(cv->elems)/cv->elemsz;
+}
+
+/* Helper to replace the element array with block, a heap block holding
+ * the same elements (e.g. rearranged by a sort). If the elements live
+ * inline they are copied back there instead, and block is freed.
+ */
+static void adopt_elems(CVector *cv, char *block)
 {
-  if (1.0*cv->capacity/cv->nelems < 2) {
-      cv->elems = realloc(cv->elems, 2*(cv->elemsz)*(cv->capacity));
-      assert(cv->elems); // assert successful allocation
-      cv->capacity *= 2;
+  if (is_inline(cv)) {
+    memcpy(cv->elems, block, cv->nelems*cv->elemsz);
+    free(block);
+    return;
   }
-} 
+  free(cv->elems);
+  cv->elems = block;
+  cv->capacity = malloc_usable_size(block)/cv->elemsz;
+}
+
+/* Helper to make room for n more elements, growing array by growth factor
+ * (or to exactly fit, if more than that is needed) only when it is full */
+static void checkCapacityFor(CVector *cv, size_t n)
+{
+  size_t needed = cv->nelems + n;
+  if (needed > cv->capacity) {
+    size_t grown = cv->capacity*cv->growth;
+    resize(cv, grown > needed ? grown : needed);
+  }
+}
+
+/* Helper to grow array by growth factor once it is full */
+static void checkCapacity(CVector *cv)
+{
+  checkCapacityFor(cv, 1);
+}
 
 /* Helper for checking index within [0, count-1] */
 static void assert_bound(int index, const CVector *cv)
@@ -68,9 +166,26 @@ CVector *cvec_create(size_t elemsz, size_t capacity_hint, CleanupElemFn fn)
   CVector* new = malloc(sizeof(struct CVectorImplementation));
   assert(new);
   new->elemsz = elemsz;
-  new->capacity = (capacity_hint > 0) ? capacity_hint : DEFAULT_CAPACITY;
-  new->elems = malloc(elemsz*new->capacity);
+  new->elems = NULL;
+  new->inline_capacity = 0;
+  resize(new, (capacity_hint > 0) ? capacity_hint : DEFAULT_CAPACITY);
+  new->nelems = 0;
+  new->growth = DEFAULT_GROWTH;
+  new->fn = fn;
+  return new;
+}
+
+CVector *cvec_create_inline(size_t elemsz, size_t inline_capacity, CleanupElemFn fn)
+{
+  assert(elemsz > 0);
+  if (inline_capacity == 0) inline_capacity = DEFAULT_INLINE_CAPACITY;
+  CVector* new = malloc(sizeof(struct CVectorImplementation) + inline_capacity*elemsz);
+  assert(new);
+  new->elemsz = elemsz;
+  new->elems = new->inline_elems;
+  new->capacity = new->inline_capacity = inline_capacity;
   new->nelems = 0;
+  new->growth = DEFAULT_GROWTH;
   new->fn = fn;
   return new;
 }
@@ -81,7 +196,7 @@ void cvec_dispose(CVector *cv)
   for(int i = 0; i < (cv->nelems); i++) {
     if(cv->fn) (cv->fn)(get_nth(cv, i));
   }
-  free(cv->elems);
+  if (!is_inline(cv)) free(cv->elems);
   free(cv);
 }
 
@@ -90,6 +205,38 @@ int cvec_count(const CVector *cv)
   return cv->nelems;
 }
 
+size_t cvec_capacity(const CVector *cv)
+{
+  return cv->capacity;
+}
+
+void cvec_set_growth(CVector *cv, double factor)
+{
+  assert(factor > 1);
+  cv->growth = factor;
+}
+
+void cvec_reserve(CVector *cv, size_t n)
+{
+  if (n > cv->capacity) resize(cv, n);
+}
+
+void cvec_shrink_to_fit(CVector *cv)
+{
+  if (is_inline(cv)) return;
+  if (cv->inline_capacity > 0 && (size_t)cv->nelems <= cv->inline_capacity) { // move back inline
+    memcpy(cv->inline_elems, cv->elems, cv->nelems*cv->elemsz);
+    free(cv->elems);
+    cv->elems = cv->inline_elems;
+    cv->capacity = cv->inline_capacity;
+    return;
+  }
+  size_t n = cv->nelems > 0 ? cv->nelems : 1; // keep a block so elems is never NULL
+  cv->elems = realloc(cv->elems, n*cv->elemsz);
+  assert(cv->elems);
+  cv->capacity = malloc_usable_size(cv->elems)/cv->elemsz;
+}
+
 void *cvec_nth(const CVector *cv, int index)
 {
   assert_bound(index, cv);
@@ -117,6 +264,23 @@ void cvec_append(CVector *cv, const void *addr)
   cv->nelems++;
 }
 
+void cvec_insert_range(CVector *cv, const void *addrs, int n, int index)
+{
+  assert(n >= 0);
+  assert(index >= 0 && index <= cv->nelems);
+  if (n == 0) return;
+  assert(addrs);
+  checkCapacityFor(cv, n);
+  memmove(get_nth(cv, index+n), get_nth(cv, index), cv->elemsz*(cv->nelems-index));
+  memcpy(get_nth(cv, index), addrs, cv->elemsz*n);
+  cv->nelems += n;
+}
+
+void cvec_append_n(CVector *cv, const void *addrs, int n)
+{
+  cvec_insert_range(cv, addrs, n, cv->nelems);
+}
+
 
 void cvec_replace(CVector *cv, const void *addr, int index)
 {
@@ -135,6 +299,38 @@ void cvec_remove(CVector *cv, int index)
   cv->nelems--;
 }
 
+void cvec_remove_range(CVector *cv, int index, int n)
+{
+  assert(n >= 0);
+  assert(index >= 0 && index <= cv->nelems - n);
+  if (cv->fn)
+    for (int i = index; i < index+n; i++) (cv->fn)(get_nth(cv, i));
+  memmove(get_nth(cv, index), get_nth(cv, index+n), cv->elemsz*(cv->nelems-index-n));
+  cv->nelems -= n;
+}
+
+/* Kept elements are moved down a run at a time: each run of elements that
+ * stay is shifted over the gap left by those removed before it */
+int cvec_remove_if(CVector *cv, PredicateFn pred, void *aux)
+{
+  int dst = 0, run = 0; // kept elements so far, start of current kept run
+  for (int i = 0; i < cv->nelems; i++) {
+    void *elem = get_nth(cv, i);
+    if (!pred(elem, aux)) continue;
+    if (cv->fn) (cv->fn)(elem);
+    if (i > run && dst != run)
+      memmove(get_nth(cv, dst), get_nth(cv, run), cv->elemsz*(i-run));
+    dst += i - run;
+    run = i + 1;
+  }
+  if (dst != run)
+    memmove(get_nth(cv, dst), get_nth(cv, run), cv->elemsz*(cv->nelems-run));
+  dst += cv->nelems - run;
+  int removed = cv->nelems - dst;
+  cv->nelems = dst;
+  return removed;
+}
+
 int cvec_search(const CVector *cv, const void *key, CompareFn cmp, int start, bool sorted)
 {
   assert(start >= 0);
@@ -152,9 +348,518 @@ int cvec_search(const CVector *cv, const void *key, CompareFn cmp, int start, bo
 
 }
 
+/* Helper for cvec_find: index of first of n elements of sz bytes at base
+ * equal to key, or n if none, comparing one element at a time.
+ */
+static size_t find_scalar(const char *base, size_t n, size_t sz, const char *key)
+{
+#define FIND_WORD(type) {                                     \
+    type k, e;                                                \
+    memcpy(&k, key, sizeof(k));                               \
+    for (size_t i = 0; i < n; i++) {                          \
+      memcpy(&e, base + i*sizeof(e), sizeof(e));              \
+      if (e == k) return i;                                   \
+    }                                                         \
+    return n;                                                 \
+  }
+  switch (sz) {
+    case 1: FIND_WORD(uint8_t)
+    case 2: FIND_WORD(uint16_t)
+    case 4: FIND_WORD(uint32_t)
+    case 8: FIND_WORD(uint64_t)
+  }
+#undef FIND_WORD
+  for (size_t i = 0; i < n; i++)
+    if (memcmp(base + i*sz, key, sz) == 0) return i;
+  return n;
+}
+
+#ifdef __x86_64__
+/* Helpers for cvec_find on elements of 1, 2, 4 or 8 bytes: compare a whole
+ * vector register of elements against copies of the key at once, and
+ * turn the result into a bitmask with one bit per byte. The lowest set bit
+ * gives the first match. Elements left over after the last full register
+ * go to find_scalar. SSE2 is part of x86-64, so is always available.
+ * It has no 64-bit compare, so it compares 8-byte elements as pairs of
+ * 4-byte halves and requires both halves to match.
+ */
+static size_t find_sse2(const char *base, size_t n, size_t sz, const char *key)
+{
+  int64_t k = 0;
+  memcpy(&k, key, sz);
+  __m128i keys = sz == 1 ? _mm_set1_epi8(k) : sz == 2 ? _mm_set1_epi16(k) :
+                 sz == 4 ? _mm_set1_epi32(k) : _mm_set1_epi64x(k);
+  size_t per = 16/sz, i = 0;
+  for (; i + per <= n; i += per) {
+    __m128i elems = _mm_loadu_si128((const __m128i *)(base + i*sz));
+    __m128i eq = sz == 1 ? _mm_cmpeq_epi8(elems, keys) :
+                 sz == 2 ? _mm_cmpeq_epi16(elems, keys) : _mm_cmpeq_epi32(elems, keys);
+    unsigned mask = _mm_movemask_epi8(eq);
+    if (sz == 8) mask = ((mask & 0xff) == 0xff) | ((mask >> 8) == 0xff) << 8;
+    if (mask != 0) return i + __builtin_ctz(mask)/sz;
+  }
+  return i + find_scalar(base + i*sz, n - i, sz, key);
+}
+
+// Compares two AVX2 registers, 64 bytes, per iteration
+__attribute__((target("avx2")))
+static size_t find_avx2(const char *base, size_t n, size_t sz, const char *key)
+{
+  int64_t k = 0;
+  memcpy(&k, key, sz);
+  __m256i keys = sz == 1 ? _mm256_set1_epi8(k) : sz == 2 ? _mm256_set1_epi16(k) :
+                 sz == 4 ? _mm256_set1_epi32(k) : _mm256_set1_epi64x(k);
+  size_t per = 64/sz, i = 0;
+  for (; i + per <= n; i += per) {
+    __m256i lo = _mm256_loadu_si256((const __m256i *)(base + i*sz));
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(base + i*sz + 32));
+    __m256i eqlo, eqhi;
+    switch (sz) {
+      case 1: eqlo = _mm256_cmpeq_epi8(lo, keys); eqhi = _mm256_cmpeq_epi8(hi, keys); break;
+      case 2: eqlo = _mm256_cmpeq_epi16(lo, keys); eqhi = _mm256_cmpeq_epi16(hi, keys); break;
+      case 4: eqlo = _mm256_cmpeq_epi32(lo, keys); eqhi = _mm256_cmpeq_epi32(hi, keys); break;
+      default: eqlo = _mm256_cmpeq_epi64(lo, keys); eqhi = _mm256_cmpeq_epi64(hi, keys); break;
+    }
+    uint64_t mask = (uint32_t)_mm256_movemask_epi8(eqlo) | (uint64_t)(uint32_t)_mm256_movemask_epi8(eqhi) << 32;
+    if (mask != 0) return i + __builtin_ctzll(mask)/sz;
+  }
+  return i + find_sse2(base + i*sz, n - i, sz, key);
+}
+#endif
+
+int cvec_find(const CVector *cv, const void *key, int start)
+{
+  assert(start >= 0);
+  assert(start <= cv->nelems);
+  const char *base = get_nth(cv, start);
+  size_t n = cv->nelems - start, sz = cv->elemsz, found;
+#ifdef __x86_64__
+  if (sz == 1 || sz == 2 || sz == 4 || sz == 8)
+    found = __builtin_cpu_supports("avx2") ? find_avx2(base, n, sz, key) : find_sse2(base, n, sz, key);
+  else
+#endif
+    found = find_scalar(base, n, sz, key);
+  return found == n ? -1 : start + (int)found;
+}
+
+/* Helper to exchange two elements of sz bytes. Moves a word at a time
+ * rather than a byte at a time, and when sz is a constant the loops
+ * collapse into a couple of plain loads and stores.
+ */
+static inline void swap_elems(char *a, char *b, size_t sz)
+{
+  for (; sz >= sizeof(uint64_t); sz -= sizeof(uint64_t), a += sizeof(uint64_t), b += sizeof(uint64_t)) {
+    uint64_t t;
+    memcpy(&t, a, sizeof(t)); memcpy(a, b, sizeof(t)); memcpy(b, &t, sizeof(t));
+  }
+  if (sz >= sizeof(uint32_t)) {
+    uint32_t t;
+    memcpy(&t, a, sizeof(t)); memcpy(a, b, sizeof(t)); memcpy(b, &t, sizeof(t));
+    sz -= sizeof(t), a += sizeof(t), b += sizeof(t);
+  }
+  for (; sz > 0; sz--, a++, b++) {
+    char t = *a; *a = *b; *b = t;
+  }
+}
+
+/* DEFINE_INTROSORT generates an introsort for elements of WIDTH bytes:
+ * quicksort on a median-of-three pivot, falling back to heapsort for
+ * ranges that recurse too deeply and to insertion sort for small ones.
+ * WIDTH is either a constant, giving a copy specialized to that size, or
+ * the sz parameter for the general case. The insertion sort only swaps
+ * out-of-order neighbors, so it is also stable and is shared by the merge
+ * sort below.
+ */
+#define DEFINE_INTROSORT(name, WIDTH)                                         \
+static void name##_insertion(char *base, size_t n, size_t sz, CompareFn cmp) \
+{                                                                             \
+  for (size_t i = 1; i < n; i++)                                              \
+    for (char *p = base + i*(WIDTH); p > base && cmp(p - (WIDTH), p) > 0; p -= (WIDTH)) \
+      swap_elems(p - (WIDTH), p, WIDTH);                                      \
+}                                                                             \
+                                                                              \
+static void name##_sift(char *base, size_t i, size_t end, size_t sz, CompareFn cmp) \
+{                                                                             \
+  for (size_t child; (child = 2*i + 1) < end; i = child) {                    \
+    if (child + 1 < end && cmp(base + child*(WIDTH), base + (child+1)*(WIDTH)) < 0) \
+      child++;                                                                \
+    if (cmp(base + i*(WIDTH), base + child*(WIDTH)) >= 0) break;              \
+    swap_elems(base + i*(WIDTH), base + child*(WIDTH), WIDTH);                \
+  }                                                                           \
+}                                                                             \
+                                                                              \
+static void name##_heap(char *base, size_t n, size_t sz, CompareFn cmp)      \
+{                                                                             \
+  for (size_t i = n/2; i-- > 0; )                                             \
+    name##_sift(base, i, n, sz, cmp);                                         \
+  for (size_t end = n - 1; end > 0; end--) {                                  \
+    swap_elems(base, base + end*(WIDTH), WIDTH);  /* max to end */            \
+    name##_sift(base, 0, end, sz, cmp);                                       \
+  }                                                                           \
+}                                                                             \
+                                                                              \
+static void name(char *base, size_t n, size_t sz, CompareFn cmp, int depth)   \
+{                                                                             \
+  while (n > INSERTION_THRESHOLD) {                                           \
+    if (depth-- == 0) {                                                       \
+      name##_heap(base, n, sz, cmp);                                          \
+      return;                                                                 \
+    }                                                                         \
+    char *first = base, *mid = base + n/2*(WIDTH), *last = base + (n-1)*(WIDTH); \
+    if (cmp(mid, first) < 0) swap_elems(mid, first, WIDTH);                   \
+    if (cmp(last, mid) < 0) {                                                 \
+      swap_elems(last, mid, WIDTH);                                           \
+      if (cmp(mid, first) < 0) swap_elems(mid, first, WIDTH);                 \
+    }                                                                         \
+    swap_elems(first, mid, WIDTH);      /* pivot is now at base */            \
+    size_t i = 1, j = n - 1;                                                  \
+    while (true) {                                                            \
+      while (i <= j && cmp(base + i*(WIDTH), base) < 0) i++;                  \
+      while (i <= j && cmp(base + j*(WIDTH), base) > 0) j--;                  \
+      if (i >= j) break;                                                      \
+      swap_elems(base + i*(WIDTH), base + j*(WIDTH), WIDTH);                  \
+      i++, j--;                                                               \
+    }                                                                         \
+    swap_elems(base, base + j*(WIDTH), WIDTH); /* pivot to final place j */   \
+    if (j < n - j - 1) {  /* recurse on smaller side, loop on larger */       \
+      name(base, j, sz, cmp, depth);                                          \
+      base += (j+1)*(WIDTH);                                                  \
+      n -= j + 1;                                                             \
+    } else {                                                                  \
+      name(base + (j+1)*(WIDTH), n - j - 1, sz, cmp, depth);                  \
+      n = j;                                                                  \
+    }                                                                         \
+  }                                                                           \
+  name##_insertion(base, n, sz, cmp);                                         \
+}
+
+DEFINE_INTROSORT(introsort_1, 1)
+DEFINE_INTROSORT(introsort_2, 2)
+DEFINE_INTROSORT(introsort_4, 4)
+DEFINE_INTROSORT(introsort_8, 8)
+DEFINE_INTROSORT(introsort_16, 16)
+DEFINE_INTROSORT(introsort_any, sz)
+
+/* Helper to sort n elements of sz bytes with the introsort for that size */
+static void sort_range(char *base, size_t n, size_t sz, CompareFn cmp)
+{
+  int depth = 0;
+  for (size_t k = n; k > 1; k >>= 1) depth += 2;  // 2*log2(n) levels before heapsort
+  switch (sz) {
+    case 1:  introsort_1(base, n, 1, cmp, depth); break;
+    case 2:  introsort_2(base, n, 2, cmp, depth); break;
+    case 4:  introsort_4(base, n, 4, cmp, depth); break;
+    case 8:  introsort_8(base, n, 8, cmp, depth); break;
+    case 16: introsort_16(base, n, 16, cmp, depth); break;
+    default: introsort_any(base, n, sz, cmp, depth); break;
+  }
+}
+
 void cvec_sort(CVector *cv, CompareFn cmp)
 {
-  qsort(cv->elems, cv->nelems, cv->elemsz, cmp);
+  sort_range(cv->elems, cv->nelems, cv->elemsz, cmp);
+}
+
+/* Helper for stable sort: sorts each half, then merges them by copying
+ * the left half out to tmp and merging back into place. Halves that are
+ * already in order relative to each other are left alone.
+ */
+static void merge_sort(char *base, size_t n, size_t sz, CompareFn cmp, char *tmp)
+{
+  if (n <= INSERTION_THRESHOLD) {
+    introsort_any_insertion(base, n, sz, cmp);
+    return;
+  }
+  size_t half = n/2;
+  char *mid = base + half*sz, *end = base + n*sz;
+  merge_sort(base, half, sz, cmp, tmp);
+  merge_sort(mid, n - half, sz, cmp, tmp);
+  if (cmp(mid - sz, mid) <= 0) return;
+
+  memcpy(tmp, base, half*sz);
+  char *left = tmp, *left_end = tmp + half*sz, *right = mid, *out = base;
+  for (; left < left_end && right < end; out += sz) {
+    if (cmp(right, left) < 0) { // take from left on ties to keep stable
+      memcpy(out, right, sz);
+      right += sz;
+    } else {
+      memcpy(out, left, sz);
+      left += sz;
+    }
+  }
+  memcpy(out, left, left_end - left); // rest of right half is already in place
+}
+
+void cvec_sort_stable(CVector *cv, CompareFn cmp)
+{
+  char *tmp = malloc((cv->nelems/2 + 1)*cv->elemsz);
+  assert(tmp);
+  merge_sort(cv->elems, cv->nelems, cv->elemsz, cmp, tmp);
+  free(tmp);
+}
+
+/* LSD radix sort on 8-bit digits. Keys are extracted once, sorted as
+ * key/index pairs, and the elements are then copied into a new array in
+ * the sorted order. A digit that is the same in every key is skipped, so
+ * small keys take only as many passes as they have significant bytes.
+ */
+void cvec_sort_by_key(CVector *cv, SortKeyFn key)
+{
+  size_t n = cv->nelems;
+  if (n < 2) return;
+  struct keyed { uint64_t key; int index; } *buf = malloc(2*n*sizeof(*buf));
+  assert(buf);
+  struct keyed *src = buf, *dst = buf + n;
+  uint64_t differ = 0;  // bits that are not the same in every key
+  for (size_t i = 0; i < n; i++) {
+    src[i] = (struct keyed){key(get_nth(cv, i)), i};
+    differ |= src[i].key ^ src[0].key;
+  }
+  for (int shift = 0; shift < 64; shift += 8) {
+    if (((differ >> shift) & 0xff) == 0) continue;
+    size_t start[257] = {0};
+    for (size_t i = 0; i < n; i++)
+      start[((src[i].key >> shift) & 0xff) + 1]++;
+    for (int d = 1; d < 256; d++)
+      start[d] += start[d-1];
+    for (size_t i = 0; i < n; i++)
+      dst[start[(src[i].key >> shift) & 0xff]++] = src[i];
+    struct keyed *t = src; src = dst; dst = t;
+  }
+
+  char *sorted = malloc(cv->capacity*cv->elemsz);
+  assert(sorted);
+  for (size_t i = 0; i < n; i++)
+    memcpy(sorted + i*cv->elemsz, get_nth(cv, src[i].index), cv->elemsz);
+  free(buf);
+  adopt_elems(cv, sorted);
+}
+
+// Eytzinger arrays start on a cache line, so a prefetch covers whole groups
+#define INDEX_ALIGN 64
+
+/* Helper to fill the Eytzinger subtree rooted at position k with the
+ * sorted elements starting from index i, in order. Returns the index of
+ * the next element not yet placed.
+ */
+static int eytzinger_fill(const CVector *cv, CVectorIndex *idx, int i, int k)
+{
+  if (k <= idx->nelems) {
+    i = eytzinger_fill(cv, idx, i, 2*k);
+    memcpy(idx->elems + k*idx->elemsz, get_nth(cv, i), idx->elemsz);
+    idx->orig[k] = i++;
+    i = eytzinger_fill(cv, idx, i, 2*k + 1);
+  }
+  return i;
+}
+
+CVectorIndex *cvec_index_create(const CVector *cv, CompareFn cmp)
+{
+  CVectorIndex *idx = malloc(sizeof(struct CVectorIndexImplementation));
+  assert(idx);
+  idx->nelems = cv->nelems;
+  idx->elemsz = cv->elemsz;
+  idx->cmp = cmp;
+  void *elems;
+  if (posix_memalign(&elems, INDEX_ALIGN, (cv->nelems + 1)*cv->elemsz) != 0) elems = NULL;
+  assert(elems);
+  idx->elems = elems;
+  idx->orig = malloc((cv->nelems + 1)*sizeof(int));
+  assert(idx->orig);
+  eytzinger_fill(cv, idx, 0, 1);
+  return idx;
+}
+
+void cvec_index_dispose(CVectorIndex *idx)
+{
+  free(idx->elems);
+  free(idx->orig);
+  free(idx);
+}
+
+/* Descends one level per step, going right whenever the element is less
+ * than the key, using the comparison result as the child offset rather
+ * than as a branch. Four levels ahead is prefetched on the way. The
+ * bits of k record the path taken. Every right turn after the last left
+ * turn is stripped off, which leaves the position of the first element not
+ * less than the key (or 0, if there is none).
+ */
+int cvec_index_search(const CVectorIndex *idx, const void *key)
+{
+  size_t sz = idx->elemsz;
+  unsigned long k = 1;
+  while (k <= (unsigned long)idx->nelems) {
+    __builtin_prefetch(idx->elems + 16*k*sz);
+    k = 2*k + (idx->cmp(idx->elems + k*sz, key) < 0);
+  }
+  k >>= __builtin_ffsl(~k);
+  if (k == 0 || idx->cmp(idx->elems + k*sz, key) != 0) return -1;
+  return idx->orig[k];
+}
+
+/* Helper to choose how many threads share n elements: the number asked
+ * for, or one per online CPU if that is 0, but no more than leaves each
+ * thread PARALLEL_MIN_CHUNK elements.
+ */
+static int thread_count(size_t n, int nthreads)
+{
+  if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t most = n / PARALLEL_MIN_CHUNK;
+  if (most < 1) most = 1;
+  return most < (size_t)nthreads ? (int)most : nthreads;
+}
+
+/* Helper to call fn on each of n jobs (an array of jobsz-byte structs),
+ * each on its own thread. The calling thread takes the first job itself,
+ * and also any job whose thread could not be started.
+ */
+static void run_threads(void *(*fn)(void *), void *jobs, size_t jobsz, int n)
+{
+  pthread_t tids[n];
+  bool started[n];
+  for (int i = 1; i < n; i++) {
+    started[i] = pthread_create(&tids[i], NULL, fn, (char *)jobs + i*jobsz) == 0;
+    if (!started[i]) fn((char *)jobs + i*jobsz);
+  }
+  fn(jobs);
+  for (int i = 1; i < n; i++)
+    if (started[i]) pthread_join(tids[i], NULL);
+}
+
+/* Type: sort_job
+ * --------------
+ * One thread's share of a parallel sort. The elements are split into
+ * nthreads chunks, one per thread, which are sorted and then merged in
+ * pairs of runs, width chunks per run, from src into dst. Each pair
+ * is merged by all threads at once, each writing its own slice of the
+ * output.
+ */
+typedef struct {
+  char *src, *dst;
+  size_t n, sz;
+  CompareFn cmp;
+  int id, nthreads, width;
+} sort_job;
+
+static size_t chunk_start(const sort_job *job, int chunk)
+{
+  if (chunk > job->nthreads) chunk = job->nthreads;
+  return job->n * chunk / job->nthreads;
+}
+
+static void *sort_chunk(void *arg)
+{
+  sort_job *job = arg;
+  size_t lo = chunk_start(job, job->id), hi = chunk_start(job, job->id + 1);
+  sort_range(job->src + lo*job->sz, hi - lo, job->sz, job->cmp);
+  return NULL;
+}
+
+/* Helper for parallel merge: returns how many of the first i elements of
+ * the merge of runs a and b come from a. Ties are taken from a first.
+ */
+static size_t co_rank(size_t i, const char *a, size_t na, const char *b, size_t nb,
+                      size_t sz, CompareFn cmp)
+{
+  size_t lo = i > nb ? i - nb : 0, hi = i < na ? i : na;
+  while (lo < hi) {
+    size_t j = lo + (hi - lo)/2, k = i - j;
+    if (k > 0 && j < na && cmp(b + (k-1)*sz, a + j*sz) >= 0) lo = j + 1;
+    else hi = j;
+  }
+  return lo;
+}
+
+static void *merge_runs(void *arg)
+{
+  sort_job *job = arg;
+  size_t sz = job->sz;
+  for (int c = 0; c < job->nthreads; c += 2*job->width) {
+    size_t lo = chunk_start(job, c), mid = chunk_start(job, c + job->width);
+    size_t hi = chunk_start(job, c + 2*job->width);
+    const char *a = job->src + lo*sz, *b = job->src + mid*sz;
+    size_t na = mid - lo, nb = hi - mid;
+    size_t first = (na + nb)*job->id/job->nthreads, last = (na + nb)*(job->id + 1)/job->nthreads;
+    size_t ia = co_rank(first, a, na, b, nb, sz, job->cmp), ib = first - ia;
+    size_t enda = co_rank(last, a, na, b, nb, sz, job->cmp), endb = last - enda;
+    char *out = job->dst + (lo + first)*sz;
+    for (; ia < enda && ib < endb; out += sz) {
+      if (job->cmp(b + ib*sz, a + ia*sz) < 0) memcpy(out, b + ib++*sz, sz);
+      else memcpy(out, a + ia++*sz, sz);
+    }
+    memcpy(out, a + ia*sz, (enda - ia)*sz);
+    memcpy(out + (enda - ia)*sz, b + ib*sz, (endb - ib)*sz);
+  }
+  return NULL;
+}
+
+void cvec_sort_parallel(CVector *cv, CompareFn cmp, int nthreads)
+{
+  int p = thread_count(cv->nelems, nthreads);
+  if (p == 1) {
+    cvec_sort(cv, cmp);
+    return;
+  }
+  char *tmp = malloc(cv->capacity*cv->elemsz);
+  assert(tmp);
+  sort_job jobs[p];
+  for (int i = 0; i < p; i++)
+    jobs[i] = (sort_job){cv->elems, tmp, cv->nelems, cv->elemsz, cmp, i, p, 0};
+  run_threads(sort_chunk, jobs, sizeof(sort_job), p);
+  for (int width = 1; width < p; width *= 2) {
+    for (int i = 0; i < p; i++) jobs[i].width = width;
+    run_threads(merge_runs, jobs, sizeof(sort_job), p);
+    for (int i = 0; i < p; i++) {
+      char *t = jobs[i].src; jobs[i].src = jobs[i].dst; jobs[i].dst = t;
+    }
+  }
+  if (jobs[0].src == tmp) adopt_elems(cv, tmp);
+  else free(tmp);
+}
+
+/* Type: search_job
+ * ----------------
+ * One thread's share of a parallel search, indexes lo to hi. found is
+ * shared by all threads and holds the lowest match yet, which lets
+ * a thread stop early once a match ahead of its chunk is known.
+ */
+typedef struct {
+  const CVector *cv;
+  const void *key;
+  CompareFn cmp;
+  int lo, hi;
+  int *found;
+} search_job;
+
+static void *search_chunk(void *arg)
+{
+  search_job *job = arg;
+  for (int i = job->lo; i < job->hi; i++) {
+    if ((i - job->lo) % SEARCH_BLOCK == 0 && __atomic_load_n(job->found, __ATOMIC_RELAXED) < i)
+      return NULL;
+    if (job->cmp(job->key, get_nth(job->cv, i)) == 0) {
+      int cur = __atomic_load_n(job->found, __ATOMIC_RELAXED);
+      while (i < cur && !__atomic_compare_exchange_n(job->found, &cur, i, true,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+int cvec_search_parallel(const CVector *cv, const void *key, CompareFn cmp, int start, int nthreads)
+{
+  assert(start >= 0);
+  assert(start <= cv->nelems);
+  int n = cv->nelems - start, p = thread_count(n, nthreads);
+  if (p == 1) return cvec_search(cv, key, cmp, start, false);
+  int found = INT_MAX;
+  search_job jobs[p];
+  for (int i = 0; i < p; i++)
+    jobs[i] = (search_job){cv, key, cmp, start + (long)n*i/p, start + (long)n*(i+1)/p, &found};
+  run_threads(search_chunk, jobs, sizeof(search_job), p);
+  return found == INT_MAX ? -1 : found;
 }
 
 void *cvec_first(const CVector *cv)
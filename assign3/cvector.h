@@ -19,6 +19,7 @@
 
 #include <stdbool.h>	//  this header defines C99 bool type
 #include <stddef.h> 	// size_t
+#include <stdint.h> 	// uint64_t
 
 /**
  * Type: CompareFn
@@ -57,6 +58,30 @@ typedef int (*CompareFn)(const void *addr1, const void *addr2);
 typedef void (*CleanupElemFn)(void *addr);
 
 
+/**
+ * Type: PredicateFn
+ * -----------------
+ * PredicateFn is the typename for a pointer to a client-supplied test
+ * function, used by cvec_remove_if to pick the elements to remove. The
+ * predicate takes a const void* pointer to an element and the client's aux
+ * pointer, which is passed through unchanged and can carry any extra state
+ * the test needs. It returns true for an element that should be removed.
+ */
+typedef bool (*PredicateFn)(const void *addr, void *aux);
+
+
+/**
+ * Type: SortKeyFn
+ * ---------------
+ * SortKeyFn is the typename for a pointer to a client-supplied function
+ * that maps an element to an unsigned integer sort key, used by
+ * cvec_sort_by_key. Elements are ordered by increasing key. A signed key
+ * must be mapped so that its order is kept, e.g. for an int field x,
+ * return (uint64_t)(int64_t)x ^ (1ULL << 63).
+ */
+typedef uint64_t (*SortKeyFn)(const void *addr);
+
+
 /**
  * Type: CVector
  * -------------
@@ -73,6 +98,17 @@ typedef void (*CleanupElemFn)(void *addr);
 typedef struct CVectorImplementation CVector;
 
 
+/**
+ * Type: CVectorIndex
+ * ------------------
+ * Defines the CVectorIndex type, a read-optimized search structure built
+ * from a sorted CVector by cvec_index_create. Like the CVector, the type is
+ * incomplete and is used only through pointers and the cvec_index_
+ * functions in this interface.
+ */
+typedef struct CVectorIndexImplementation CVectorIndex;
+
+
 /**
  * Function: cvec_create
  * Usage: CVector *v = cvec_create(sizeof(int), 10, NULL)
@@ -112,6 +148,26 @@ typedef struct CVectorImplementation CVector;
 CVector *cvec_create(size_t elemsz, size_t capacity_hint, CleanupElemFn fn);
 
 
+/**
+ * Function: cvec_create_inline
+ * Usage: CVector *v = cvec_create_inline(sizeof(char *), 8, NULL)
+ * ---------------------------------------------------------------
+ * Creates a new empty CVector as for cvec_create, except that storage for
+ * the first inline_capacity elements is part of the CVector itself. A
+ * CVector that never holds more than that takes a single allocation and
+ * no separate array. Once it outgrows the inline storage, its elements
+ * move to the heap and it behaves like any other CVector, and
+ * cvec_shrink_to_fit will move them back if they fit again. This suits
+ * programs that make many small CVectors. If inline_capacity is 0, an
+ * internal default value is used. The returned CVector is used with all
+ * the same functions, including cvec_dispose.
+ *
+ * Asserts: zero elemsz, allocation failure
+ * Assumes: cleanup fn is valid
+ */
+CVector *cvec_create_inline(size_t elemsz, size_t inline_capacity, CleanupElemFn fn);
+
+
 /**
  * Function: cvec_dispose
  * Usage: cvec_dispose(v)
@@ -132,6 +188,58 @@ void cvec_dispose(CVector *cv);
 int cvec_count(const CVector *cv);
 
 
+/**
+ * Function: cvec_capacity
+ * Usage: size_t capacity = cvec_capacity(v)
+ * -----------------------------------------
+ * Returns the number of elements the CVector can hold before its storage
+ * must be enlarged. This is at least the count, and may be more than was
+ * asked for, as the CVector uses all of the memory the allocator gave it.
+ * Operates in constant-time.
+ */
+size_t cvec_capacity(const CVector *cv);
+
+
+/**
+ * Function: cvec_set_growth
+ * Usage: cvec_set_growth(v, 1.5)
+ * ------------------------------
+ * Sets the factor by which the capacity is multiplied when a full CVector
+ * needs room for another element. The default is 2. A smaller factor such
+ * as 1.5 wastes less memory at the cost of more frequent resizing. An
+ * assert is raised if factor is not greater than 1. Operates in constant-time.
+ *
+ * Asserts: factor <= 1
+ */
+void cvec_set_growth(CVector *cv, double factor);
+
+
+/**
+ * Function: cvec_reserve
+ * Usage: cvec_reserve(v, 1000)
+ * ----------------------------
+ * Enlarges the capacity to hold at least n elements, so that adding up to
+ * that many elements needs no further resizing. Does nothing if the
+ * capacity is already large enough. An assert is raised on allocation
+ * failure. Operates in linear-time.
+ *
+ * Asserts: allocation failure
+ */
+void cvec_reserve(CVector *cv, size_t n);
+
+
+/**
+ * Function: cvec_shrink_to_fit
+ * Usage: cvec_shrink_to_fit(v)
+ * ----------------------------
+ * Reduces the capacity to the count, releasing unused storage back to the
+ * allocator. Useful once a CVector is done growing and will be kept for a
+ * long time. Pointers into the CVector may become invalid. Operates in
+ * linear-time.
+ */
+void cvec_shrink_to_fit(CVector *cv);
+
+
 /**
  * Function: cvec_nth
  * Usage: int num = *(int *)cvec_nth(v, 0)
@@ -183,6 +291,29 @@ void cvec_insert(CVector *cv, const void *addr, int index);
  * Assumes: address of valid elem
  */
 void cvec_append(CVector *cv, const void *addr);
+
+
+/**
+ * Functions: cvec_insert_range, cvec_append_n
+ * Usage: cvec_insert_range(v, arr, 10, 0)
+ *        cvec_append_n(v, arr, 10)
+ * ----------------------------------------
+ * Adds n elements in one operation. addrs is expected to point to a
+ * contiguous array of n elements, such as a C array of the type stored
+ * in the CVector. The values are copied into the CVector, keeping their
+ * order. cvec_insert_range places the first of them at the given index,
+ * shifting up the elements after it just once for the whole range.
+ * cvec_append_n adds them at the end. The capacity is enlarged at most once.
+ * An assert is raised if n is negative, if index is less than 0 or
+ * greater than the count, or on allocation failure. addrs must not point
+ * into the CVector's own storage. Operates in linear-time, in the number
+ * of elements added plus the number shifted.
+ *
+ * Asserts: invalid index or n, allocation failure
+ * Assumes: addrs points to n valid elems
+ */
+void cvec_insert_range(CVector *cv, const void *addrs, int n, int index);
+void cvec_append_n(CVector *cv, const void *addrs, int n);
   
   
 /**
@@ -222,6 +353,36 @@ void cvec_replace(CVector *cv, const void *addr, int index);
  * empty so it does nothing).
  */
 void cvec_remove(CVector *cv, int index);
+
+
+/**
+ * Function: cvec_remove_range
+ * Usage: cvec_remove_range(v, 0, 10)
+ * ----------------------------------
+ * Removes the n elements starting at the given index, then shifts the
+ * elements after them down once to close the gap. The client's cleanup
+ * function is called on each removed element. An assert is raised if n is
+ * negative or the range extends outside the CVector. Operates in
+ * linear-time.
+ *
+ * Asserts: invalid index or n
+ */
+void cvec_remove_range(CVector *cv, int index, int n);
+
+
+/**
+ * Function: cvec_remove_if
+ * Usage: int removed = cvec_remove_if(v, is_empty_string, NULL)
+ * -------------------------------------------------------------
+ * Removes every element for which the pred callback returns true, calling
+ * the client's cleanup function on each one removed. The aux pointer is
+ * passed to each call of pred. The remaining elements keep their relative
+ * order, and are compacted in a single pass over the CVector. Returns
+ * the number of elements removed. Operates in linear-time.
+ *
+ * Assumes: pred fn is valid
+ */
+int cvec_remove_if(CVector *cv, PredicateFn pred, void *aux);
   
   
 /**
@@ -255,18 +416,147 @@ void cvec_remove(CVector *cv, int index);
 int cvec_search(const CVector *cv, const void *keyaddr, CompareFn cmp, int start, bool sorted);
 
 
+/**
+ * Function: cvec_find
+ * Usage: int found = cvec_find(v, &inode, 0)
+ * ------------------------------------------
+ * Searches the CVector for an element whose bytes are identical to those
+ * of the key element, starting from the start index, and returns the index
+ * of the first match or -1 if there is none. keyaddr is expected to be a
+ * valid pointer to the key element. No comparator is used, so this is
+ * meant for elements such as ints, chars and pointers. It does not suit
+ * structs with padding or floating point values, whose equal values
+ * can have different bytes. For elements of 1, 2, 4 or 8 bytes,
+ * the comparison is done many elements at a time using the widest vector
+ * instructions the CPU supports. An assert is raised if start is less
+ * than 0 or greater than the count. Operates in linear-time.
+ *
+ * Asserts: invalid start index
+ * Assumes: address of valid key
+ */
+int cvec_find(const CVector *cv, const void *keyaddr, int start);
+
+
+/**
+ * Function: cvec_search_parallel
+ * Usage: int found = cvec_search_parallel(v, &key, cmp_students, 0, 0)
+ * --------------------------------------------------------------------
+ * Linear search as for cvec_search with sorted false, split across
+ * nthreads threads, or one per online CPU if nthreads is 0. Each thread
+ * scans its own chunk of the elements from start to end. Unlike
+ * cvec_search, the index returned is always that of the first matching
+ * element, or -1 if there is none. The cmp callback is called from several
+ * threads at once, so must be safe to do so. Vectors too small to be worth
+ * splitting are searched on the calling thread. An assert is raised if
+ * start is less than 0 or greater than the count. Operates in linear-time.
+ *
+ * Asserts: invalid start index
+ * Assumes: address of valid key, cmp fn is valid and thread-safe
+ */
+int cvec_search_parallel(const CVector *cv, const void *keyaddr, CompareFn cmp, int start, int nthreads);
+
+
+/**
+ * Functions: cvec_index_create, cvec_index_search, cvec_index_dispose
+ * Usage: CVectorIndex *idx = cvec_index_create(v, cmp_students)
+ *        int found = cvec_index_search(idx, &key)
+ *        cvec_index_dispose(idx)
+ * --------------------------------------------------------------------
+ * Provide faster repeated searching of a large sorted CVector that rarely
+ * changes. cvec_index_create copies the CVector's elements into a layout
+ * that keeps the elements a binary search visits close together in
+ * memory, and fetches them ahead of need. The CVector must already be
+ * sorted by cmp, which the index keeps for its searches. The index is a
+ * snapshot: later changes to the CVector are not reflected, so build a
+ * new index after changing it. The element values are copied bytewise,
+ * so elements that own memory (such as strings) must stay valid while
+ * the index is in use. cvec_index_create raises an assert on allocation
+ * failure and operates in linear-time.
+ *
+ * cvec_index_search returns the index in the CVector of an element
+ * matching the key, or -1 if there is none. If several match, it is the
+ * first of them. keyaddr is expected to be a valid pointer to a key
+ * element, as for cvec_search. Operates in logarithmic-time.
+ *
+ * cvec_index_dispose deallocates the index. It does not call any cleanup
+ * function, as the elements still belong to the CVector.
+ *
+ * Asserts: allocation failure
+ * Assumes: CVector sorted by cmp, address of valid key, cmp fn is valid
+ */
+CVectorIndex *cvec_index_create(const CVector *cv, CompareFn cmp);
+int cvec_index_search(const CVectorIndex *idx, const void *keyaddr);
+void cvec_index_dispose(CVectorIndex *idx);
+
+
 /**
  * Function: cvec_sort
  * Usage: cvec_sort(v, cmp_student)
  * --------------------------------
  * Rearranges elements in the CVector into ascending order according to the 
- * client's provided cmp callback. Operates in NlgN-time.
+ * client's provided cmp callback. The sort is an introsort with element
+ * moves specialized for 1, 2, 4, 8 and 16 byte elements. It is not stable:
+ * elements that compare equal may end up in any order. Operates in
+ * NlgN-time.
  *
  * Assumes: cmp fn is valid
  */  
 void cvec_sort(CVector *cv, CompareFn cmp);
 
 
+/**
+ * Function: cvec_sort_stable
+ * Usage: cvec_sort_stable(v, cmp_student)
+ * ---------------------------------------
+ * Sorts as for cvec_sort, but elements that compare equal keep their
+ * original relative order. This is a merge sort, which uses temporary
+ * storage for half the elements. An assert is raised on allocation failure.
+ * Operates in NlgN-time, and linear-time if already sorted.
+ *
+ * Asserts: allocation failure
+ * Assumes: cmp fn is valid
+ */
+void cvec_sort_stable(CVector *cv, CompareFn cmp);
+
+
+/**
+ * Function: cvec_sort_parallel
+ * Usage: cvec_sort_parallel(v, cmp_student, 0)
+ * --------------------------------------------
+ * Sorts as for cvec_sort, using nthreads threads, or one per online CPU if
+ * nthreads is 0. The elements are split into one chunk per thread. Each
+ * thread sorts its chunk, then the sorted chunks are merged pairwise. All
+ * threads share every merge, each writing its own part of the output. The
+ * cmp callback is called from several threads at once, so must be safe to
+ * do so. Vectors too small to be worth splitting are sorted on the calling
+ * thread. Uses temporary storage for a copy of the elements, and pointers
+ * into the CVector become invalid. An assert is raised on allocation
+ * failure. Operates in NlgN-time, divided among the threads.
+ *
+ * Asserts: allocation failure
+ * Assumes: cmp fn is valid and thread-safe
+ */
+void cvec_sort_parallel(CVector *cv, CompareFn cmp, int nthreads);
+
+
+/**
+ * Function: cvec_sort_by_key
+ * Usage: cvec_sort_by_key(v, student_id)
+ * --------------------------------------
+ * Sorts the elements into ascending order of the integer key computed for
+ * each by the key callback, without comparing elements. Calls key once per
+ * element. The sort is a radix sort and stable. It makes one pass per byte
+ * of key that varies between elements, so it is fastest when keys are
+ * small. It uses temporary storage for a key and index per element and for
+ * a new copy of the elements. Pointers into the CVector become invalid. An
+ * assert is raised on allocation failure. Operates in linear-time.
+ *
+ * Asserts: allocation failure
+ * Assumes: key fn is valid
+ */
+void cvec_sort_by_key(CVector *cv, SortKeyFn key);
+
+
 /**
  * Functions: cvec_first, cvec_next
  * Usage: for (void *cur = cvec_first(v); cur != NULL; cur = cvec_next(v, cur))
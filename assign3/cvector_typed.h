@@ -0,0 +1,409 @@
+/* File: cvector_typed.h
+ * ---------------------
+ * Generates a CVector specialized for one element type.
+ *
+ * The generic CVector in cvector.h works on any type by passing elements
+ * through void* pointers and copying elemsz bytes at a time. That costs a
+ * multiply on every access and a memcpy call on every add, and it hides
+ * the element type from the compiler. The CVEC_DEFINE macro below
+ * instead expands to a vector type and a family of static inline functions
+ * for a given element type. Elements are passed and returned by value or
+ * through typed pointers, assigned directly, and sized by the compiler.
+ *
+ * The operations mirror cvector.h one for one, and behave the same way,
+ * including the asserts. The generic CVector is unchanged and remains the
+ * right choice when the element type is not known until runtime.
+ *
+ * Usage: place CVEC_DEFINE at file scope, once per element type, e.g.
+ *
+ *     CVEC_DEFINE(IntVector, ivec, int)
+ *     CVEC_DEFINE(WordVector, wvec, char *)
+ *
+ *     IntVector *v = ivec_create(0, NULL);
+ *     ivec_append(v, 42);
+ *     int num = *ivec_nth(v, 0);
+ *
+ * The element type must be a single type name that can be declared by
+ * appending a "*", so use a typedef for anything more elaborate (arrays,
+ * function pointers). Callbacks take elements as T const *, which for a
+ * pointer type puts the const on the element itself, e.g. a comparator
+ * for WordVector is declared int cmp(char *const *a, char *const *b).
+ */
+
+#ifndef _cvector_typed_h
+#define _cvector_typed_h
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a suggested value to use when given capacity_hint is 0
+#define CVEC_DEFAULT_CAPACITY 16
+// capacity is multiplied by this when a full vector grows
+#define CVEC_DEFAULT_GROWTH 2.0
+// sorts hand ranges this small to insertion sort
+#define CVEC_INSERTION_THRESHOLD 16
+
+/**
+ * Macro: CVEC_DEFINE
+ * Usage: CVEC_DEFINE(IntVector, ivec, int)
+ * ----------------------------------------
+ * Defines the type VecType, a vector of elements of type T, together with
+ * the types prefix_cmp_fn, prefix_cleanup_fn, prefix_pred_fn and
+ * prefix_key_fn for its comparator, cleanup, predicate and sort key
+ * callbacks. Each takes typed pointers to elements instead of void*. Also
+ * defines these operations, each the typed counterpart of the cvec_
+ * function of the same name:
+ *
+ *   VecType *prefix_create(size_t capacity_hint, prefix_cleanup_fn fn)
+ *   void prefix_dispose(VecType *v)
+ *   int prefix_count(const VecType *v)
+ *   size_t prefix_capacity(const VecType *v)
+ *   void prefix_set_growth(VecType *v, double factor)
+ *   void prefix_reserve(VecType *v, size_t n)
+ *   void prefix_shrink_to_fit(VecType *v)
+ *   T *prefix_nth(const VecType *v, int index)
+ *   void prefix_insert(VecType *v, T elem, int index)
+ *   void prefix_append(VecType *v, T elem)
+ *   void prefix_insert_range(VecType *v, T const *elems, int n, int index)
+ *   void prefix_append_n(VecType *v, T const *elems, int n)
+ *   void prefix_replace(VecType *v, T elem, int index)
+ *   void prefix_remove(VecType *v, int index)
+ *   void prefix_remove_range(VecType *v, int index, int n)
+ *   int prefix_remove_if(VecType *v, prefix_pred_fn pred, void *aux)
+ *   int prefix_search(const VecType *v, T const *key, prefix_cmp_fn cmp, int start, bool sorted)
+ *   void prefix_sort(VecType *v, prefix_cmp_fn cmp)
+ *   void prefix_sort_stable(VecType *v, prefix_cmp_fn cmp)
+ *   void prefix_sort_by_key(VecType *v, prefix_key_fn key)
+ *   T *prefix_first(const VecType *v)
+ *   T *prefix_next(const VecType *v, T const *prev)
+ *
+ * The struct is visible so that these functions can be inlined, but its
+ * fields are private to the implementation, the same as for a CVector.
+ * The sorts use the same algorithms as cvector.c, but move elements by
+ * assignment. The comparator is still called through a pointer, so sorting
+ * costs about the same as cvec_sort on elements of the same size.
+ */
+#define CVEC_DEFINE(VecType, prefix, T)                                        \
+                                                                               \
+typedef int (*prefix##_cmp_fn)(T const *addr1, T const *addr2);               \
+typedef void (*prefix##_cleanup_fn)(T *addr);                                  \
+typedef bool (*prefix##_pred_fn)(T const *addr, void *aux);                    \
+typedef uint64_t (*prefix##_key_fn)(T const *addr);                            \
+                                                                               \
+typedef struct {                                                               \
+  T *elems;                                                                    \
+  size_t capacity;                                                             \
+  int nelems;                                                                  \
+  double growth;                                                               \
+  prefix##_cleanup_fn fn;                                                      \
+} VecType;                                                                     \
+                                                                               \
+/* Helper to (re)allocate array to hold at least n elements, with capacity    \
+ * set from the usable size of the block received */                          \
+static inline void prefix##_resize(VecType *v, size_t n)                       \
+{                                                                              \
+  if (v->elems && n <= malloc_usable_size(v->elems)/sizeof(T)) {              \
+    v->capacity = malloc_usable_size(v->elems)/sizeof(T);                     \
+    return;                                                                    \
+  }                                                                            \
+  v->elems = realloc(v->elems, n*sizeof(T));                                   \
+  assert(v->elems);                                                            \
+  v->capacity = malloc_usable_size(v->elems)/sizeof(T);                       \
+}                                                                              \
+                                                                               \
+/* Helper to make room for n more elements, growing array by growth factor  \
+ * (or to exactly fit, if more than that is needed) only when it is full */   \
+static inline void prefix##_check_capacity(VecType *v, size_t n)               \
+{                                                                              \
+  size_t needed = v->nelems + n;                                               \
+  if (needed > v->capacity) {                                                  \
+    size_t grown = v->capacity*v->growth;                                      \
+    prefix##_resize(v, grown > needed ? grown : needed);                       \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+static inline VecType *prefix##_create(size_t capacity_hint, prefix##_cleanup_fn fn) \
+{                                                                              \
+  VecType *v = malloc(sizeof(VecType));                                        \
+  assert(v);                                                                   \
+  v->elems = NULL;                                                             \
+  prefix##_resize(v, capacity_hint > 0 ? capacity_hint : CVEC_DEFAULT_CAPACITY); \
+  v->nelems = 0;                                                               \
+  v->growth = CVEC_DEFAULT_GROWTH;                                             \
+  v->fn = fn;                                                                  \
+  return v;                                                                    \
+}                                                                              \
+                                                                               \
+static inline void prefix##_dispose(VecType *v)                                \
+{                                                                              \
+  if (v->fn)                                                                   \
+    for (int i = 0; i < v->nelems; i++) v->fn(&v->elems[i]);                   \
+  free(v->elems);                                                              \
+  free(v);                                                                     \
+}                                                                              \
+                                                                               \
+static inline int prefix##_count(const VecType *v)                             \
+{                                                                              \
+  return v->nelems;                                                            \
+}                                                                              \
+                                                                               \
+static inline size_t prefix##_capacity(const VecType *v)                       \
+{                                                                              \
+  return v->capacity;                                                          \
+}                                                                              \
+                                                                               \
+static inline void prefix##_set_growth(VecType *v, double factor)              \
+{                                                                              \
+  assert(factor > 1);                                                          \
+  v->growth = factor;                                                          \
+}                                                                              \
+                                                                               \
+static inline void prefix##_reserve(VecType *v, size_t n)                      \
+{                                                                              \
+  if (n > v->capacity) prefix##_resize(v, n);                                  \
+}                                                                              \
+                                                                               \
+static inline void prefix##_shrink_to_fit(VecType *v)                          \
+{                                                                              \
+  v->elems = realloc(v->elems, (v->nelems > 0 ? v->nelems : 1)*sizeof(T));     \
+  assert(v->elems);                                                            \
+  v->capacity = malloc_usable_size(v->elems)/sizeof(T);                       \
+}                                                                              \
+                                                                               \
+static inline T *prefix##_nth(const VecType *v, int index)                     \
+{                                                                              \
+  assert(index >= 0 && index < v->nelems);                                     \
+  return &v->elems[index];                                                     \
+}                                                                              \
+                                                                               \
+static inline void prefix##_append(VecType *v, T elem)                         \
+{                                                                              \
+  prefix##_check_capacity(v, 1);                                               \
+  v->elems[v->nelems++] = elem;                                                \
+}                                                                              \
+                                                                               \
+static inline void prefix##_insert(VecType *v, T elem, int index)              \
+{                                                                              \
+  assert(index >= 0 && index <= v->nelems);                                    \
+  prefix##_check_capacity(v, 1);                                               \
+  memmove(&v->elems[index+1], &v->elems[index], (v->nelems-index)*sizeof(T));  \
+  v->elems[index] = elem;                                                      \
+  v->nelems++;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void prefix##_insert_range(VecType *v, T const *elems, int n, int index) \
+{                                                                              \
+  assert(n >= 0 && index >= 0 && index <= v->nelems);                          \
+  if (n == 0) return;                                                          \
+  prefix##_check_capacity(v, n);                                               \
+  memmove(&v->elems[index+n], &v->elems[index], (v->nelems-index)*sizeof(T));  \
+  memcpy(&v->elems[index], elems, n*sizeof(T));                                \
+  v->nelems += n;                                                              \
+}                                                                              \
+                                                                               \
+static inline void prefix##_append_n(VecType *v, T const *elems, int n)        \
+{                                                                              \
+  prefix##_insert_range(v, elems, n, v->nelems);                               \
+}                                                                              \
+                                                                               \
+static inline void prefix##_replace(VecType *v, T elem, int index)             \
+{                                                                              \
+  T *old = prefix##_nth(v, index);                                             \
+  if (v->fn) v->fn(old);                                                       \
+  *old = elem;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void prefix##_remove(VecType *v, int index)                      \
+{                                                                              \
+  T *old = prefix##_nth(v, index);                                             \
+  if (v->fn) v->fn(old);                                                       \
+  memmove(old, old + 1, (v->nelems-index-1)*sizeof(T));                        \
+  v->nelems--;                                                                 \
+}                                                                              \
+                                                                               \
+static inline void prefix##_remove_range(VecType *v, int index, int n)         \
+{                                                                              \
+  assert(n >= 0 && index >= 0 && index <= v->nelems - n);                      \
+  if (v->fn)                                                                   \
+    for (int i = index; i < index+n; i++) v->fn(&v->elems[i]);                 \
+  memmove(&v->elems[index], &v->elems[index+n], (v->nelems-index-n)*sizeof(T)); \
+  v->nelems -= n;                                                              \
+}                                                                              \
+                                                                               \
+/* Single pass, each kept element is assigned down over the removed ones */   \
+static inline int prefix##_remove_if(VecType *v, prefix##_pred_fn pred, void *aux) \
+{                                                                              \
+  int dst = 0;                                                                 \
+  for (int i = 0; i < v->nelems; i++) {                                        \
+    if (!pred(&v->elems[i], aux)) {                                            \
+      v->elems[dst++] = v->elems[i];                                           \
+    } else if (v->fn) {                                                        \
+      v->fn(&v->elems[i]);                                                     \
+    }                                                                          \
+  }                                                                            \
+  int removed = v->nelems - dst;                                               \
+  v->nelems = dst;                                                             \
+  return removed;                                                              \
+}                                                                              \
+                                                                               \
+static inline int prefix##_search(const VecType *v, T const *key,              \
+                                  prefix##_cmp_fn cmp, int start, bool sorted) \
+{                                                                              \
+  assert(start >= 0 && start <= v->nelems);                                    \
+  if (!sorted) {                                                               \
+    for (int i = start; i < v->nelems; i++)                                    \
+      if (cmp(key, &v->elems[i]) == 0) return i;                               \
+    return -1;                                                                 \
+  }                                                                            \
+  int lo = start, hi = v->nelems - 1;                                          \
+  while (lo <= hi) {                                                           \
+    int mid = lo + (hi - lo)/2;                                                \
+    int c = cmp(key, &v->elems[mid]);                                          \
+    if (c == 0) return mid;                                                    \
+    if (c < 0) hi = mid - 1;                                                   \
+    else lo = mid + 1;                                                         \
+  }                                                                            \
+  return -1;                                                                   \
+}                                                                              \
+                                                                               \
+static inline void prefix##_insertion_sort(T *base, size_t n, prefix##_cmp_fn cmp) \
+{                                                                              \
+  for (size_t i = 1; i < n; i++) {                                             \
+    T elem = base[i];                                                          \
+    size_t j = i;                                                              \
+    for (; j > 0 && cmp(&base[j-1], &elem) > 0; j--) base[j] = base[j-1];      \
+    base[j] = elem;                                                            \
+  }                                                                            \
+}                                                                              \
+                                                                               \
+static inline void prefix##_sift(T *base, size_t i, size_t end, prefix##_cmp_fn cmp) \
+{                                                                              \
+  T elem = base[i];                                                            \
+  for (size_t child; (child = 2*i + 1) < end; i = child) {                     \
+    if (child + 1 < end && cmp(&base[child], &base[child+1]) < 0) child++;     \
+    if (cmp(&elem, &base[child]) >= 0) break;                                  \
+    base[i] = base[child];                                                     \
+  }                                                                            \
+  base[i] = elem;                                                              \
+}                                                                              \
+                                                                               \
+static inline void prefix##_introsort(T *base, size_t n, prefix##_cmp_fn cmp, int depth) \
+{                                                                              \
+  while (n > CVEC_INSERTION_THRESHOLD) {                                       \
+    if (depth-- == 0) {  /* heapsort */                                        \
+      for (size_t i = n/2; i-- > 0; ) prefix##_sift(base, i, n, cmp);          \
+      for (size_t end = n - 1; end > 0; end--) {                               \
+        T max = base[0]; base[0] = base[end]; base[end] = max;                 \
+        prefix##_sift(base, 0, end, cmp);                                      \
+      }                                                                        \
+      return;                                                                  \
+    }                                                                          \
+    T t;                                                                       \
+    T *mid = &base[n/2];                                                       \
+    T *last = &base[n-1];                                                      \
+    if (cmp(mid, base) < 0) { t = *mid; *mid = *base; *base = t; }             \
+    if (cmp(last, mid) < 0) {                                                  \
+      t = *last; *last = *mid; *mid = t;                                       \
+      if (cmp(mid, base) < 0) { t = *mid; *mid = *base; *base = t; }           \
+    }                                                                          \
+    T pivot = *mid; *mid = *base; *base = pivot;                               \
+    size_t i = 1, j = n - 1;                                                   \
+    while (true) {                                                             \
+      while (i <= j && cmp(&base[i], &pivot) < 0) i++;                         \
+      while (i <= j && cmp(&base[j], &pivot) > 0) j--;                         \
+      if (i >= j) break;                                                       \
+      t = base[i]; base[i++] = base[j]; base[j--] = t;                         \
+    }                                                                          \
+    base[0] = base[j]; base[j] = pivot;                                        \
+    if (j < n - j - 1) {                                                       \
+      prefix##_introsort(base, j, cmp, depth);                                 \
+      base += j + 1;                                                           \
+      n -= j + 1;                                                              \
+    } else {                                                                   \
+      prefix##_introsort(base + j + 1, n - j - 1, cmp, depth);                 \
+      n = j;                                                                   \
+    }                                                                          \
+  }                                                                            \
+  prefix##_insertion_sort(base, n, cmp);                                       \
+}                                                                              \
+                                                                               \
+static inline void prefix##_sort(VecType *v, prefix##_cmp_fn cmp)              \
+{                                                                              \
+  int depth = 0;                                                               \
+  for (int n = v->nelems; n > 1; n >>= 1) depth += 2;                          \
+  prefix##_introsort(v->elems, v->nelems, cmp, depth);                         \
+}                                                                              \
+                                                                               \
+static inline void prefix##_merge_sort(T *base, size_t n, prefix##_cmp_fn cmp, T *tmp) \
+{                                                                              \
+  if (n <= CVEC_INSERTION_THRESHOLD) {                                         \
+    prefix##_insertion_sort(base, n, cmp);                                     \
+    return;                                                                    \
+  }                                                                            \
+  size_t half = n/2, left = 0, right = half, out = 0;                          \
+  prefix##_merge_sort(base, half, cmp, tmp);                                   \
+  prefix##_merge_sort(base + half, n - half, cmp, tmp);                        \
+  if (cmp(&base[half-1], &base[half]) <= 0) return;                            \
+  memcpy(tmp, base, half*sizeof(T));                                           \
+  while (left < half && right < n)                                             \
+    base[out++] = cmp(&base[right], &tmp[left]) < 0 ? base[right++] : tmp[left++]; \
+  while (left < half) base[out++] = tmp[left++];                               \
+}                                                                              \
+                                                                               \
+static inline void prefix##_sort_stable(VecType *v, prefix##_cmp_fn cmp)       \
+{                                                                              \
+  T *tmp = malloc((v->nelems/2 + 1)*sizeof(T));                                \
+  assert(tmp);                                                                 \
+  prefix##_merge_sort(v->elems, v->nelems, cmp, tmp);                          \
+  free(tmp);                                                                   \
+}                                                                              \
+                                                                               \
+static inline void prefix##_sort_by_key(VecType *v, prefix##_key_fn key)       \
+{                                                                              \
+  size_t n = v->nelems;                                                        \
+  if (n < 2) return;                                                           \
+  uint64_t *keys = malloc(2*n*sizeof(uint64_t));                               \
+  T *sorted = malloc(v->capacity*sizeof(T));                                   \
+  assert(keys && sorted);                                                      \
+  uint64_t *srck = keys, *dstk = keys + n, differ = 0;                         \
+  T *src = v->elems;                                                           \
+  T *dst = sorted;                                                             \
+  for (size_t i = 0; i < n; i++) {                                            \
+    srck[i] = key(&src[i]);                                                    \
+    differ |= srck[i] ^ srck[0];                                               \
+  }                                                                            \
+  for (int shift = 0; shift < 64; shift += 8) {                                \
+    if (((differ >> shift) & 0xff) == 0) continue;                             \
+    size_t start[257] = {0};                                                   \
+    for (size_t i = 0; i < n; i++) start[((srck[i] >> shift) & 0xff) + 1]++;   \
+    for (int d = 1; d < 256; d++) start[d] += start[d-1];                      \
+    for (size_t i = 0; i < n; i++) {                                           \
+      size_t pos = start[(srck[i] >> shift) & 0xff]++;                         \
+      dstk[pos] = srck[i];                                                     \
+      dst[pos] = src[i];                                                       \
+    }                                                                          \
+    uint64_t *tk = srck; srck = dstk; dstk = tk;                               \
+    T *te = src; src = dst; dst = te;                                          \
+  }                                                                            \
+  free(keys);                                                                  \
+  free(dst);       /* whichever array the elements are not in */               \
+  v->elems = src;                                                              \
+  v->capacity = malloc_usable_size(src)/sizeof(T);                             \
+}                                                                              \
+                                                                               \
+static inline T *prefix##_first(const VecType *v)                              \
+{                                                                              \
+  return v->nelems > 0 ? v->elems : NULL;                                      \
+}                                                                              \
+                                                                               \
+static inline T *prefix##_next(const VecType *v, T const *prev)                \
+{                                                                              \
+  return prev + 1 < v->elems + v->nelems ? (T *)prev + 1 : NULL;               \
+}
+
+#endif
@@ -13,7 +13,6 @@
 #include <string.h>
 #include <error.h>
 
-#define NUM_SYNONYMS 16
 #define NUM_HEADWORDS 35000
 
 static void cleanup_cvec(void *p)
@@ -63,13 +62,18 @@ static CMap *read_thesaurus(FILE *fp)
         char *cur = line;
         sscanf(line, "%127[^,]", buffer);   // first word of line is headword
         cur += strlen(buffer);
-        CVector *synonyms = cvec_create(sizeof(char *), NUM_SYNONYMS, cleanup_str);
-        cmap_put(thesaurus, buffer, &synonyms);
+        char headword[sizeof(buffer)];
+        strcpy(headword, buffer);
+        char *words[sizeof(line)/2];        // each word takes at least 2 chars of line
+        int nwords = 0;
         while (sscanf(cur, ",%127[^,]", buffer) == 1) { // all subsequent words are synonyms
-            char *synonym = strdup(buffer);
-            cvec_append(synonyms, &synonym);
+            words[nwords++] = strdup(buffer);
             cur += strlen(buffer) + 1;
         }
+        // sized to hold the whole line inline, one allocation per vector
+        CVector *synonyms = cvec_create_inline(sizeof(char *), nwords, cleanup_str);
+        cvec_append_n(synonyms, words, nwords);
+        cmap_put(thesaurus, headword, &synonyms);
         if (cmap_count(thesaurus) % 1000 == 0) {
             printf(".");
             fflush(stdout);
@@ -7,10 +7,15 @@
 */
 
 #include "cvector.h"
+#include "cvector_typed.h"
 #include <error.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+CVEC_DEFINE(IntVector, ivec, int)
+CVEC_DEFINE(WordVector, wvec, char *)
 
 
 /* Function: verify_int
@@ -80,6 +85,166 @@ static void simple_cvec()
 }
 
 
+/* Function: count_cleanup
+* ------------------------
+* Cleanup function that counts how many elements it has been called on.
+*/
+static int ncleaned;
+static void count_cleanup(void *addr)
+{
+    (void)addr;
+    ncleaned++;
+}
+
+
+/* Function: is_negative
+* ---------------------
+* Predicate used with cvec_remove_if to select negative integers.
+*/
+static bool is_negative(const void *addr, void *aux)
+{
+    (void)aux;
+    return *(const int *)addr < 0;
+}
+
+
+/* Function: range_cvec
+* ---------------------
+* Exercises the operations that add or remove a run of elements at once
+* (insert_range/append_n/remove_range/remove_if), checking the order of
+* the elements moved around them and the calls to the cleanup function.
+*/
+static void range_cvec()
+{
+    printf("\n----------------- Testing range cvec ------------------ \n");
+    CVector *cv = cvec_create(sizeof(int), 4, count_cleanup);
+    int arr[] = {-1, -2, -3};
+
+    printf("\nAppending 4 numbers then 3 more, to force growth.\n");
+    for (int i = 0; i < 4; i++)
+        cvec_append(cv, &i);                       // 0|1|2|3
+    cvec_append_n(cv, arr, 3);                     // 0|1|2|3|-1|-2|-3
+    verify_int(7, cvec_count(cv), "cvec_count");
+    verify_int(1, cvec_capacity(cv) >= 7, "cvec_capacity >= 7");
+    verify_int(3, *(int *)cvec_nth(cv, 3), "*value for cvec_nth(3)");
+    verify_int(-3, *(int *)cvec_nth(cv, 6), "*value for cvec_nth(6)");
+
+    printf("\nInsert range at front, middle and end.\n");
+    cvec_insert_range(cv, arr, 2, 0);              // -1|-2|0|1|2|3|-1|-2|-3
+    cvec_insert_range(cv, arr, 3, 4);              // -1|-2|0|1|-1|-2|-3|2|3|-1|-2|-3
+    cvec_insert_range(cv, arr, 1, cvec_count(cv)); // ...|-1|-2|-3|-1
+    verify_int(13, cvec_count(cv), "cvec_count");
+    verify_int(-2, *(int *)cvec_nth(cv, 1), "*value for cvec_nth(1)");
+    verify_int(0, *(int *)cvec_nth(cv, 2), "*value for cvec_nth(2)");
+    verify_int(1, *(int *)cvec_nth(cv, 3), "*value for cvec_nth(3)");
+    verify_int(-1, *(int *)cvec_nth(cv, 4), "*value for cvec_nth(4)");
+    verify_int(-3, *(int *)cvec_nth(cv, 6), "*value for cvec_nth(6)");
+    verify_int(2, *(int *)cvec_nth(cv, 7), "*value for cvec_nth(7)");
+    verify_int(-1, *(int *)cvec_nth(cv, 12), "*value for cvec_nth(12)");
+
+    printf("\nRemove range from the middle.\n");
+    ncleaned = 0;
+    cvec_remove_range(cv, 4, 3);                   // -1|-2|0|1|2|3|-1|-2|-3|-1
+    verify_int(3, ncleaned, "Cleanup calls");
+    verify_int(10, cvec_count(cv), "cvec_count");
+    verify_int(2, *(int *)cvec_nth(cv, 4), "*value for cvec_nth(4)");
+    verify_int(-1, *(int *)cvec_nth(cv, 9), "*value for cvec_nth(9)");
+
+    printf("\nRemove all negative numbers.\n");
+    ncleaned = 0;
+    verify_int(6, cvec_remove_if(cv, is_negative, NULL), "Count removed");
+    verify_int(6, ncleaned, "Cleanup calls");
+    verify_int(4, cvec_count(cv), "cvec_count");     // 0|1|2|3
+    for (int i = 0; i < cvec_count(cv); i++)
+        verify_int(i, *(int *)cvec_nth(cv, i), "*value in order");
+    verify_int(0, cvec_remove_if(cv, is_negative, NULL), "Count removed");
+
+    ncleaned = 0;
+    cvec_dispose(cv);
+    verify_int(4, ncleaned, "Cleanup calls on dispose");
+}
+
+
+/* Function: capacity_cvec
+* ------------------------
+* Exercises the capacity operations (reserve/set_growth/shrink_to_fit),
+* checking that the capacity always covers the count, that a reserved
+* vector is not resized while filling up to the reserved size, and that
+* a small growth factor still makes room for another element.
+*/
+static void capacity_cvec()
+{
+    printf("\n----------------- Testing capacity cvec ------------------ \n");
+    CVector *cv = cvec_create(sizeof(int), 1, NULL);
+
+    printf("\nAppending 100 numbers with growth factor 1.1.\n");
+    cvec_set_growth(cv, 1.1);
+    int too_small = 0;
+    for (int i = 0; i < 100; i++) {
+        cvec_append(cv, &i);
+        too_small += cvec_capacity(cv) < (size_t)cvec_count(cv);
+    }
+    verify_int(100, cvec_count(cv), "cvec_count");
+    verify_int(0, too_small, "Appends leaving capacity < count");
+    verify_int(99, *(int *)cvec_nth(cv, 99), "*value for cvec_nth(99)");
+
+    printf("\nReserving 1000 then appending up to it.\n");
+    cvec_reserve(cv, 1000);
+    size_t reserved = cvec_capacity(cv);
+    void *elems = cvec_first(cv);
+    verify_int(1, reserved >= 1000, "cvec_capacity >= 1000");
+    for (int i = 100; i < 1000; i++)
+        cvec_append(cv, &i);
+    verify_int(reserved, cvec_capacity(cv), "cvec_capacity after appends");
+    verify_int(1, elems == cvec_first(cv), "Same storage after appends");
+    cvec_reserve(cv, 10);
+    verify_int(reserved, cvec_capacity(cv), "cvec_capacity after smaller reserve");
+
+    printf("\nRemoving all, shrinking and reusing.\n");
+    cvec_remove_range(cv, 0, cvec_count(cv));
+    cvec_shrink_to_fit(cv);
+    verify_int(0, cvec_count(cv), "cvec_count");
+    verify_int(1, cvec_capacity(cv) < reserved, "cvec_capacity shrunk");
+    for (int i = 0; i < 10; i++)
+        cvec_append(cv, &i);
+    verify_int(10, cvec_count(cv), "cvec_count");
+    verify_int(1, cvec_capacity(cv) >= 10, "cvec_capacity >= 10");
+    verify_int(9, *(int *)cvec_nth(cv, 9), "*value for cvec_nth(9)");
+    cvec_dispose(cv);
+}
+
+
+/* Function: inline_cvec
+* ----------------------
+* Exercises a CVector with inline storage, filling it past the inline
+* capacity so its elements move to the heap, then shrinking it so they
+* move back.
+*/
+static void inline_cvec()
+{
+    printf("\n----------------- Testing inline cvec ------------------ \n");
+    CVector *cv = cvec_create_inline(sizeof(int), 4, NULL);
+    for (int i = 0; i < 4; i++)
+        cvec_insert(cv, &i, 0);                    // 3|2|1|0
+    verify_int(4, cvec_capacity(cv), "cvec_capacity while inline");
+    verify_int(3, *(int *)cvec_nth(cv, 0), "*value for cvec_nth(0)");
+
+    printf("\nAppending past inline capacity.\n");
+    for (int i = 4; i < 10; i++)
+        cvec_append(cv, &i);                       // 3|2|1|0|4|5|6|7|8|9
+    verify_int(1, cvec_capacity(cv) >= 10, "cvec_capacity >= 10");
+    verify_int(0, *(int *)cvec_nth(cv, 3), "*value for cvec_nth(3)");
+    verify_int(9, *(int *)cvec_nth(cv, 9), "*value for cvec_nth(9)");
+
+    printf("\nRemoving and shrinking back inline.\n");
+    cvec_remove_range(cv, 0, 7);                   // 7|8|9
+    cvec_shrink_to_fit(cv);
+    verify_int(4, cvec_capacity(cv), "cvec_capacity after shrink");
+    verify_int(8, *(int *)cvec_nth(cv, 1), "*value for cvec_nth(1)");
+    cvec_dispose(cv);
+}
+
+
 /* Function: cmp_char
 * ------------------
 * Comparator function used to compare two character elements within a cvector.
@@ -111,6 +276,8 @@ static void sortsearch_test()
     verify_int(0, cvec_search(cv, &jumbled[0], cmp_char, 0, false), "Linear search");
     verify_int(9, cvec_search(cv, &jumbled[9], cmp_char, 0, false), "Linear search");
     verify_int(-1, cvec_search(cv, &ch, cmp_char, 10, false), "Linear search");
+    verify_int(9, cvec_find(cv, &jumbled[9], 0), "Find");
+    verify_int(-1, cvec_find(cv, &jumbled[9], 10), "Find");
 
     printf("\nSorting cvector.\n");
     cvec_sort(cv, cmp_char);	 // Sort into alpha order
@@ -176,10 +343,442 @@ static void large_test(int size)
     cvec_dispose(cv);
 }
 
+
+static int cmp_int_typed(const int *p1, const int *p2)
+{
+    return *p1 - *p2;
+}
+
+
+/* Function: parallel_test
+* ------------------------
+* Exercises the parallel search and sort with 2 to 5 threads on a vector
+* large enough to be split. Values repeat in every chunk, so the search
+* must return the first match overall, not just the first in some chunk.
+*/
+static void parallel_test(int size)
+{
+    printf("\n----------------- Testing parallel search & sort ------------------ \n");
+    CVector *cv = cvec_create(sizeof(int), size, NULL);
+    long sum = 0;
+    for (int i = 0; i < size; i++) {
+        int val = rand() % 1000;
+        cvec_append(cv, &val);
+        sum += val;
+    }
+    int last = 5000;
+    int absent = -1;
+    int start = size/3 + 7;
+    sum += last - *(int *)cvec_nth(cv, size - 2);
+    cvec_replace(cv, &last, size - 2);  // only in the final chunk
+
+    for (int nthreads = 2; nthreads <= 5; nthreads++) {
+        printf("\nUsing %d threads.\n", nthreads);
+        int key = *(int *)cvec_nth(cv, size - 100);  // repeated across chunks
+        verify_int(cvec_search(cv, &key, cmp_int, 0, false),
+                   cvec_search_parallel(cv, &key, cmp_int, 0, nthreads), "Repeated key from 0");
+        verify_int(cvec_search(cv, &key, cmp_int, start, false),
+                   cvec_search_parallel(cv, &key, cmp_int, start, nthreads), "Repeated key from start");
+        verify_int(size - 2, cvec_search_parallel(cv, &last, cmp_int, start, nthreads), "Key in last chunk");
+        verify_int(-1, cvec_search_parallel(cv, &absent, cmp_int, 0, nthreads), "Absent key");
+    }
+
+    for (int nthreads = 2; nthreads <= 5; nthreads++) {
+        CVector *copy = cvec_create(sizeof(int), size, NULL);
+        cvec_append_n(copy, cvec_first(cv), cvec_count(cv));
+        cvec_sort_parallel(copy, cmp_int, nthreads);
+        int unsorted = 0;
+        long sorted_sum = *(int *)cvec_nth(copy, 0);
+        for (int i = 1; i < cvec_count(copy); i++) {
+            unsorted += *(int *)cvec_nth(copy, i-1) > *(int *)cvec_nth(copy, i);
+            sorted_sum += *(int *)cvec_nth(copy, i);
+        }
+        printf("\nParallel sort with %d threads.\n", nthreads);
+        verify_int(0, unsorted, "Elements out of order");
+        verify_int(size, cvec_count(copy), "cvec_count");
+        verify_int(1, sorted_sum == sum, "Same elements after sort");
+        verify_int(last, *(int *)cvec_nth(copy, size - 1), "*value for last");
+        cvec_dispose(copy);
+    }
+    cvec_dispose(cv);
+}
+
+
+/* Function: typed_cvec
+* ---------------------
+* Exercises the typed vector generated by CVEC_DEFINE with the same
+* sequence of operations as simple_cvec, to check they agree.
+*/
+static void typed_cvec()
+{
+    printf("\n----------------- Testing typed cvec ------------------ \n");
+    IntVector *v = ivec_create(4, NULL); // small, forces realloc
+    for (int i = 0; i < 10; i++)
+        ivec_append(v, i);                         // 0|1|2|3|4|5|6|7|8|9
+    verify_int(10, ivec_count(v), "ivec_count");
+    verify_int(5, *ivec_nth(v, 5), "*value for ivec_nth(5)");
+
+    for (int i = 0; i < ivec_count(v); i += 2)
+        ivec_replace(v, -i, i);                    //0|1|-2|3|-4|5|-6|7|-8|9
+    verify_int(-2, *ivec_nth(v, 2), "*value for ivec_nth(2)");
+
+    ivec_insert(v, 99, 3);
+    ivec_insert(v, 99, 6);
+    ivec_insert(v, 99, ivec_count(v));        //0|1|-2|99|3|-4|99|5|-6|7|-8|9|99
+    verify_int(13, ivec_count(v), "ivec_count");
+    verify_int(99, *ivec_nth(v, 12), "*value for ivec_nth(12)");
+
+    ivec_remove(v, 3);
+    ivec_remove(v, 5);                         //0|1|-2|3|-4|5|-6|7|-8|9|99
+    verify_int(11, ivec_count(v), "ivec_count");
+    verify_int(5, *ivec_nth(v, 5), "*value for ivec_nth(5)");
+
+    int sum = 0;
+    for (int *cur = ivec_first(v); cur != NULL; cur = ivec_next(v, cur))
+        sum += *cur;
+    verify_int(104, sum, "sum over iteration");
+
+    ivec_sort(v, cmp_int_typed);
+    int key = 3;
+    verify_int(-8, *ivec_nth(v, 0), "*value for ivec_nth(0) after sort");
+    verify_int(6, ivec_search(v, &key, cmp_int_typed, 0, true), "Binary search");
+    verify_int(6, ivec_search(v, &key, cmp_int_typed, 0, false), "Linear search");
+    key = 4;
+    verify_int(-1, ivec_search(v, &key, cmp_int_typed, 0, true), "Binary search");
+    ivec_dispose(v);
+}
+
+
+static int cmp_word(char *const *p1, char *const *p2)
+{
+    return strcmp(*p1, *p2);
+}
+
+static void free_word(char **p)
+{
+    free(*p);
+}
+
+static bool starts_with(char *const *p, void *aux)
+{
+    return **p == *(char *)aux;
+}
+
+
+/* Function: typed_words
+* ----------------------
+* Exercises a typed vector of strings, where the element type is itself a
+* pointer. Sorts enough words to go past insertion sort into the
+* partitioning code, then searches and filters them.
+*/
+static void typed_words(int size)
+{
+    printf("\n----------------- Testing typed words ------------------ \n");
+    WordVector *v = wvec_create(0, free_word);
+    srand(107);
+    for (int i = 0; i < size; i++) {
+        char word[8];
+        sprintf(word, "%c%04d", 'a' + i % 26, rand() % 10000);
+        wvec_append(v, strdup(word));
+    }
+    char *middle = strdup(*wvec_nth(v, size/2));
+
+    printf("Sorting %d words.\n", size);
+    wvec_sort(v, cmp_word);
+    int unsorted = 0;
+    for (int i = 1; i < wvec_count(v); i++)
+        unsorted += cmp_word(wvec_nth(v, i-1), wvec_nth(v, i)) > 0;
+    verify_int(0, unsorted, "Words out of order");
+    int found = wvec_search(v, &middle, cmp_word, 0, true);
+    verify_int(0, found < 0 ? -1 : strcmp(*wvec_nth(v, found), middle), "Binary search finds word");
+    found = wvec_search(v, &middle, cmp_word, 0, false);
+    verify_int(0, found < 0 ? -1 : strcmp(*wvec_nth(v, found), middle), "Linear search finds word");
+
+    printf("Removing words starting with 'a'.\n");
+    int removed = wvec_remove_if(v, starts_with, "a");
+    verify_int(size - (size + 25)/26, wvec_count(v), "wvec_count");
+    verify_int((size + 25)/26, removed, "removed");
+    verify_int('b', **wvec_first(v), "first letter");
+    free(middle);
+    wvec_dispose(v);
+}
+
+
+static double elapsed_ms(clock_t start)
+{
+    return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+
+/* Function: benchmark
+* --------------------
+* Times the generic CVector against the typed IntVector on the same
+* workload of ints: append, indexed reads, sort and searches. Both
+* should produce the same checksum.
+*/
+static void benchmark(int size)
+{
+    printf("\n----------------- Benchmark generic vs typed ------------------ \n");
+    printf("%-10s %12s %12s\n", "operation", "generic ms", "typed ms");
+    int nsearches = size / 10;
+    long sum[2] = {0, 0};
+    double ms[2][4];
+
+    CVector *cv = cvec_create(sizeof(int), 0, NULL);
+    srand(107);
+    clock_t start = clock();
+    for (int i = 0; i < size; i++) {
+        int val = rand() % size;
+        cvec_append(cv, &val);
+    }
+    ms[0][0] = elapsed_ms(start);
+    start = clock();
+    for (int i = 0; i < cvec_count(cv); i++)
+        sum[0] += *(int *)cvec_nth(cv, i);
+    ms[0][1] = elapsed_ms(start);
+    start = clock();
+    cvec_sort(cv, cmp_int);
+    ms[0][2] = elapsed_ms(start);
+    start = clock();
+    for (int i = 0; i < nsearches; i++)
+        sum[0] += cvec_search(cv, cvec_nth(cv, i * 10), cmp_int, 0, true) >= 0;
+    ms[0][3] = elapsed_ms(start);
+    cvec_dispose(cv);
+
+    IntVector *v = ivec_create(0, NULL);
+    srand(107);
+    start = clock();
+    for (int i = 0; i < size; i++)
+        ivec_append(v, rand() % size);
+    ms[1][0] = elapsed_ms(start);
+    start = clock();
+    for (int i = 0; i < ivec_count(v); i++)
+        sum[1] += *ivec_nth(v, i);
+    ms[1][1] = elapsed_ms(start);
+    start = clock();
+    ivec_sort(v, cmp_int_typed);
+    ms[1][2] = elapsed_ms(start);
+    start = clock();
+    for (int i = 0; i < nsearches; i++)
+        sum[1] += ivec_search(v, ivec_nth(v, i * 10), cmp_int_typed, 0, true) >= 0;
+    ms[1][3] = elapsed_ms(start);
+    ivec_dispose(v);
+
+    char *ops[] = {"append", "nth", "sort", "search"};
+    for (int i = 0; i < 4; i++)
+        printf("%-10s %12.2f %12.2f\n", ops[i], ms[0][i], ms[1][i]);
+    verify_int(1, sum[0] == sum[1], "Checksums match");
+}
+
+
+typedef struct {
+    int key;
+    int seq;        // original position, to check stability
+    char name[16];
+} record;
+
+static int cmp_record(const void *p1, const void *p2)
+{
+    return ((const record *)p1)->key - ((const record *)p2)->key;
+}
+
+static int cmp_ptr(const void *p1, const void *p2)
+{
+    char *a = *(char **)p1, *b = *(char **)p2;
+    return (a > b) - (a < b);
+}
+
+static uint64_t int_key(const void *p)
+{
+    return (uint64_t)(int64_t)*(const int *)p ^ (1ULL << 63);
+}
+
+static uint64_t int_key_typed(const int *p)
+{
+    return (uint64_t)(int64_t)*p ^ (1ULL << 63);
+}
+
+static uint64_t record_key(const void *p)
+{
+    return ((const record *)p)->key;
+}
+
+/* Function: check_sorted
+* -----------------------
+* Returns whether the elements are in ascending order by cmp, and, for
+* records if stable is set, whether equal keys kept their original order.
+*/
+static bool check_sorted(const void *base, int n, size_t elemsz, CompareFn cmp, bool stable)
+{
+    for (int i = 1; i < n; i++) {
+        const char *prev = (const char *)base + (i-1)*elemsz, *cur = prev + elemsz;
+        int c = cmp(prev, cur);
+        if (c > 0 || (stable && c == 0 && ((const record *)prev)->seq > ((const record *)cur)->seq))
+            return false;
+    }
+    return true;
+}
+
+typedef enum { QSORT, SORT, STABLE, BY_KEY, PARALLEL, TYPED, TYPED_STABLE, TYPED_BY_KEY } sorter;
+
+/* Function: time_sort
+* --------------------
+* Fills a vector with size random elements (ints, or records with few
+* distinct keys), times one sorter on it and checks the result.
+*/
+static void time_sort(char *label, sorter how, int size, bool records)
+{
+    size_t elemsz = records ? sizeof(record) : sizeof(int);
+    CompareFn cmp = records ? cmp_record : cmp_int;
+    CVector *cv = cvec_create(elemsz, size, NULL);
+    IntVector *v = ivec_create(size, NULL);
+    srand(107);
+    for (int i = 0; i < size; i++) {
+        record r = {rand() % (records ? 1000 : size), i, "x"};
+        if (records) cvec_append(cv, &r);
+        else if (how >= TYPED) ivec_append(v, r.key - size/2);
+        else cvec_append(cv, &(int){r.key - size/2});
+    }
+
+    clock_t start = clock();
+    switch (how) {
+        case QSORT: qsort(cvec_first(cv), cvec_count(cv), elemsz, cmp); break;
+        case SORT: cvec_sort(cv, cmp); break;
+        case STABLE: cvec_sort_stable(cv, cmp); break;
+        case BY_KEY: cvec_sort_by_key(cv, records ? record_key : int_key); break;
+        case PARALLEL: cvec_sort_parallel(cv, cmp, 0); break;
+        case TYPED: ivec_sort(v, cmp_int_typed); break;
+        case TYPED_STABLE: ivec_sort_stable(v, cmp_int_typed); break;
+        case TYPED_BY_KEY: ivec_sort_by_key(v, int_key_typed); break;
+    }
+    double ms = elapsed_ms(start);
+    bool ok = how >= TYPED ? check_sorted(ivec_first(v), ivec_count(v), sizeof(int), cmp_int, false)
+                           : check_sorted(cvec_first(cv), cvec_count(cv), elemsz, cmp,
+                                          records && (how == STABLE || how == BY_KEY));
+    printf("%-22s %10.2f  %s\n", label, ms, ok ? "ok" : "##### PROBLEM HERE #####");
+    cvec_dispose(cv);
+    ivec_dispose(v);
+}
+
+/* Function: sort_benchmark
+* -------------------------
+* Times each sort against libc qsort, on ints and on 24-byte records whose
+* keys repeat often, checking every result is sorted (and stable where
+* promised).
+*/
+static void sort_benchmark(int size)
+{
+    printf("\n----------------- Sort benchmark (%d elements) ------------------ \n", size);
+    printf("%-22s %10s\n", "sort", "ms");
+    time_sort("int qsort", QSORT, size, false);
+    time_sort("int cvec_sort", SORT, size, false);
+    time_sort("int cvec_sort_stable", STABLE, size, false);
+    time_sort("int cvec_sort_by_key", BY_KEY, size, false);
+    time_sort("int cvec_sort_parallel", PARALLEL, size, false);
+    time_sort("int ivec_sort", TYPED, size, false);
+    time_sort("int ivec_sort_stable", TYPED_STABLE, size, false);
+    time_sort("int ivec_sort_by_key", TYPED_BY_KEY, size, false);
+    time_sort("record qsort", QSORT, size, true);
+    time_sort("record cvec_sort", SORT, size, true);
+    time_sort("record cvec_sort_stable", STABLE, size, true);
+    time_sort("record cvec_sort_by_key", BY_KEY, size, true);
+    time_sort("record cvec_sort_parallel", PARALLEL, size, true);
+}
+
+/* Function: find_benchmark
+* -------------------------
+* Times the comparator-based linear cvec_search against cvec_find, on
+* ints and on pointers, searching for keys spread through the vector.
+* Both must find the same first match every time.
+*/
+static void find_benchmark(int size)
+{
+    printf("\n----------------- Find benchmark (%d elements) ------------------ \n", size);
+    printf("%-10s %12s %12s\n", "elements", "search ms", "find ms");
+    int nsearches = 200;
+    CVector *ints = cvec_create(sizeof(int), size, NULL);
+    CVector *ptrs = cvec_create(sizeof(void *), size, NULL);
+    for (int i = 0; i < size; i++) {
+        int val = rand() % size;
+        void *ptr = (char *)ptrs + val;
+        cvec_append(ints, &val);
+        cvec_append(ptrs, &ptr);
+    }
+
+    CVector *vecs[] = {ints, ptrs};
+    CompareFn cmps[] = {cmp_int, cmp_ptr};
+    char *names[] = {"int", "pointer"};
+    for (int v = 0; v < 2; v++) {
+        int found[2][nsearches];
+        double ms[2];
+        for (int how = 0; how < 2; how++) {
+            clock_t start = clock();
+            for (int i = 0; i < nsearches; i++) {
+                void *key = cvec_nth(vecs[v], (long)size * i / nsearches);
+                found[how][i] = how == 0 ? cvec_search(vecs[v], key, cmps[v], 0, false)
+                                         : cvec_find(vecs[v], key, 0);
+            }
+            ms[how] = elapsed_ms(start);
+        }
+        printf("%-10s %12.2f %12.2f\n", names[v], ms[0], ms[1]);
+        verify_int(0, memcmp(found[0], found[1], sizeof(found[0])), "Same matches found");
+    }
+    cvec_dispose(ints);
+    cvec_dispose(ptrs);
+}
+
+/* Function: index_benchmark
+* --------------------------
+* Times binary search with cvec_search against a CVectorIndex built from
+* the same sorted vector of ints, looking up keys both present and absent.
+* Both must agree on whether each key is found, and on the value found.
+*/
+static void index_benchmark(int size)
+{
+    printf("\n----------------- Index benchmark (%d elements) ------------------ \n", size);
+    int nsearches = 2000000, agree = 0;
+    CVector *cv = cvec_create(sizeof(int), size, NULL);
+    for (int i = 0; i < size; i++) {
+        int val = 2*i;  // odd keys are absent
+        cvec_append(cv, &val);
+    }
+    clock_t start = clock();
+    CVectorIndex *idx = cvec_index_create(cv, cmp_int);
+    printf("Built index in %.2f ms\n", elapsed_ms(start));
+
+    int *keys = malloc(nsearches*sizeof(int)), *found = malloc(nsearches*sizeof(int));
+    for (int i = 0; i < nsearches; i++)
+        keys[i] = rand() % (2*size);
+    start = clock();
+    for (int i = 0; i < nsearches; i++)
+        found[i] = cvec_search(cv, &keys[i], cmp_int, 0, true);
+    double search_ms = elapsed_ms(start);
+    start = clock();
+    for (int i = 0; i < nsearches; i++)
+        agree += cvec_index_search(idx, &keys[i]) == found[i];
+    double index_ms = elapsed_ms(start);
+    printf("%d lookups: cvec_search %.2f ms, cvec_index_search %.2f ms\n", nsearches, search_ms, index_ms);
+    verify_int(nsearches, agree, "Lookups agreeing");
+    free(keys);
+    free(found);
+    cvec_index_dispose(idx);
+    cvec_dispose(cv);
+}
+
 int main(int argc, char *argv[])
 {
     simple_cvec();
+    range_cvec();
+    capacity_cvec();
+    inline_cvec();
     sortsearch_test();
     large_test(25000);
+    parallel_test(65537*2);
+    typed_cvec();
+    typed_words(200);
+    benchmark(1000000);
+    sort_benchmark(1000000);
+    find_benchmark(1000000);
+    index_benchmark(4000000);
     return 0;
 }
@@ -2,24 +2,35 @@
  * File: allocator.c
  * Author: YOUR NAME HERE
  * ----------------------
- * A trivial allocator. Very simple code, heinously inefficient.
- * An allocation request is serviced by incrementing the heap segment
- * to place new block on its own page(s). The block has a pre-node header
- * containing size information. Free is a no-op: blocks are never coalesced
- * or reused. Realloc is implemented using malloc/memcpy/free.
- * Using page-per-node means low utilization. Because it grows the heap segment
- * (using expensive OS call) for each node, it also has low throughput
- * and terrible cache performance.  The code is not robust in terms of
- * handling unusual cases either.
+ * An explicit free list allocator with segregated buckets. Every block has
+ * a 4-byte header and matching 4-byte footer holding the block size and the
+ * allocation status in the low bit. Free blocks additionally store <prev>
+ * and <succ> links in their payload, and are kept in one of BUCKETNUMBER
+ * doubly-linked lists chosen by block size (roughly power-of-two classes).
  *
- * In short, this implementation has not much going for it other than being
- * the smallest amount of code that "works" for ordinary cases.  But
- * even that's still a good place to start from.
+ * The heap segment is laid out as
+ *
+ *     [pad][block][block]...[block][epilogue]
+ *
+ * where pad and epilogue are single words marked allocated with size 0.
+ * The pad word shifts every header to 4 mod 8, so every payload lands on
+ * an 8-byte boundary. The two sentinels mean coalesce never needs a special
+ * case for the first or last block of the heap. When no free block fits,
+ * the segment is extended and the new pages are merged with the trailing
+ * free block, if there is one. Once the segment is full, the heap carries
+ * on in another segment laid out the same way, so blocks never span two
+ * segments and the sentinels keep coalesce from merging across the gap.
  */
 
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "allocator.h"
 #include "segment.h"
 #include <math.h>
@@ -27,13 +38,110 @@
 
 // Heap blocks are required to be aligned to 8-byte boundary
 #define ALIGNMENT 8
-#define BUCKETNUMBER 13 // number of buckets 
+#define BUCKETNUMBER 13 // number of buckets
 #define SWORD 4 // size of word
+#define MIN_BLOCK (3 * ALIGNMENT) // header + prev + succ + footer
+#define MAX_REQUEST ((size_t)1 << 31) // block size must fit in 4-byte header
+#define MAX_BLOCK ((size_t)UINT32_MAX & ~(size_t)(ALIGNMENT - 1)) // largest size a header holds
+#define MOVABLE 2 // status bit for a handle block that compaction may relocate
 #define MIN(X, Y) (((X) <= (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) >= (Y)) ? (X) : (Y))
 static void *arr_of_list[BUCKETNUMBER]; // array of linked list
 static void *hpptr;
 static int numpages;
 
+// Segments past the first (default) one, used once the heap outgrows it.
+// Segment 0 is hpptr and numpages, segment i > 0 is extra_segs[i - 1].
+// Growth always happens in the last segment.
+#define MAX_SEGMENTS 64
+static segment_t extra_segs[MAX_SEGMENTS - 1];
+static int nsegs = 1;
+static size_t free_total;              // bytes in all free lists, kept by insert/delete
+static char *fresh_start;              // see below
+static char *fit_fresh;                // fresh_start as of find_fit's last search
+
+// Memory pressure settings, see heap_set_limits
+static size_t soft_limit, hard_limit;   // 0 for no limit
+static pressurefn_t pressure_fn;
+static void *pressure_aux;
+static bool soft_signalled;             // callback already told heap is past soft limit
+static bool in_pressure;                // inside callback, don't call it again
+static void *heap_root;                 // client's entry point into heap, saved in snapshots
+static int heap_fd = -1;                // file holding heap in persistent mode, else -1
+static bool heap_readonly;              // mapped read-only from file, no allocation allowed
+
+// Handle table, itself an ordinary block in the heap. Entry 0 is never
+// used so that 0 can stand for no handle. Unused entries are chained
+// through next, starting at handle_free_list. The payload of a movable
+// block starts with the index of its handle, and the entry points just
+// past that.
+typedef struct {
+    void *ptr;                          // client data, NULL if entry unused
+    unsigned int pins;                  // block stays put while nonzero
+    unsigned int next;                  // next unused entry
+} handle_entry;
+static handle_entry *handle_table;
+static size_t handle_count;             // entries in table
+static size_t handle_free_list;
+static void *compact_cursor;            // header of next block for heap_compact, NULL between passes
+
+// Caches of freed small blocks for mymalloc_fixed/myfree_fixed, see
+// allocator.h. Cached blocks stay marked allocated in the heap.
+#define FAST_LIMIT 64                  // blocks cached per class
+#define FAST_BATCH 8                   // blocks carved per refill
+fastlist_t allocator_fast_lists[FAST_CLASSES];
+
+// A snapshot file is one page holding this header, followed by the heap
+// segment itself. Everything else the allocator needs to resume is in the
+// segment, or recomputed on restore. The one pointer from the segment to
+// outside it is the prev link of each list's first block, which is fixed
+// up on restore in case the program was loaded at another address.
+#define SNAPSHOT_MAGIC "HEAPSNAP"
+#define SNAPSHOT_VERSION 2
+
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    void *base;                         // segment address, must match on restore
+    size_t npages;
+    void *lists[BUCKETNUMBER];          // arr_of_list
+    size_t free_total;
+    size_t fresh_offset;                // fresh_start relative to base
+    void *root;
+    handle_entry *handles;
+    size_t handle_count, handle_free_list;
+} snapshot_t;
+static unsigned long heap_version;     // bumped whenever the free lists change
+
+// State for validate_heap_slice: header of the next block to check, free
+// bytes seen so far in the current pass and heap_version when pass began.
+// slice_cursor is NULL when no pass is underway.
+static void *slice_cursor;
+static size_t slice_free;
+static unsigned long slice_version;
+
+// Pages from extend_heap_segment come zero-filled. Every byte from
+// fresh_start to the end of the segment is still zero, except for the
+// header, list links and footer of the free block that holds fresh_start,
+// and the epilogue. Allocating moves fresh_start past the new block, so
+// mycalloc only clears the part of a block below the old fresh_start plus
+// the stale list links at the front of the payload. The old value is the
+// one find_fit saw when it searched, as a pressure callback run before the
+// search may have dirtied memory past any value read earlier.
+
+// Canary mode (build with -DALLOCATOR_CANARY) pads every request so the
+// bytes past the requested size can be filled with a known pattern, the
+// requested size itself is stored in the last word of the payload. Free and
+// realloc check the pattern, an overrun is reported on stderr and makes
+// validate_heap fail from then on.
+#ifdef ALLOCATOR_CANARY
+#define CANARY_PAD (sizeof(size_t) + ALIGNMENT) // size slot plus minimum guard
+#define CANARY_BYTE 0xA5
+static bool canary_tripped;
+#else
+#define CANARY_PAD 0
+#endif
+
 typedef struct {
     int hdrsz;   // header contains just one 4-byte field
 } headerT;
@@ -55,17 +163,10 @@ static inline void *payload_for_hdr(headerT *header)
     return (char *)header + sizeof(headerT);
 }
 
-static inline void set_status(headerT *ptr, int status) // ptr is a pointer to header
-{
-    *(unsigned int *)ptr = ((*(unsigned int *)ptr) & (~1)) + status;
-//    ((char *)ptr)[ALIGNMENT * SWORD - 1] = status;
-}
-
 // return the allocation status (1:allocated; 0:free)
 static inline int get_status(void *ptr)
 {
     return ((*(unsigned int *)ptr) & 1);
-    // (int)(((char *)ptr)[ALIGNMENT * SWORD - 1]);
 }
 
 // return a pointer to the <prev> section in current block
@@ -80,75 +181,106 @@ static inline void *get_succ(void *ptr) // ptr points to header of freee block
     return (char *)ptr + sizeof(headerT) + sizeof(void *);
 }
 
-// set the <prev> section of current block 
+// set the <prev> section of current block
 static inline void set_prev(void *ptr, void *prev) //ptr to header of free block, prev is a pointer to somewhere else(prev block's header or the head of linked list).
 {
     *(void **)get_prev(ptr) = prev;
 }
 
-// set the <succ> section of current block 
+// set the <succ> section of current block
 static inline void set_succ(void *ptr, void *succ) // ptr to header of free block
 {
     *(void **)get_succ(ptr) = succ;
 }
 
 // use bitmask to obtain the block size in header
-static inline int get_blocksz(void *ptr) // ptr is a pointer to header 
+static inline size_t get_blocksz(void *ptr) // ptr is a pointer to header
 {
     return (*(unsigned int *)ptr) & (~0x7);
 }
 
-// given block size, find the most suitible index 
+static inline char *seg_start(int i)
+{
+    return i ? extra_segs[i - 1].start : hpptr;
+}
+
+static inline size_t seg_size(int i)
+{
+    return i ? extra_segs[i - 1].size : (size_t)numpages * PAGE_SIZE;
+}
+
+// header of the epilogue word, one word before the end of segment i
+static inline void *seg_epilogue(int i)
+{
+    return seg_start(i) + seg_size(i) - SWORD;
+}
+
+// epilogue of the last segment, where the heap grows
+static inline void *epilogue(void)
+{
+    return seg_epilogue(nsegs - 1);
+}
+
+// index of the segment holding ptr, or -1 if none
+static int seg_for(void *ptr)
+{
+    for (int i = 0; i < nsegs; i++)
+        if ((char *)ptr >= seg_start(i) && (char *)ptr < seg_start(i) + seg_size(i)) return i;
+    return -1;
+}
+
+// bytes in all segments, what the heap limits and pressure callback see
+static size_t heap_bytes(void)
+{
+    size_t total = 0;
+    for (int i = 0; i < nsegs; i++)
+        total += seg_size(i);
+    return total;
+}
+
+// Header of the block that follows block ptr in a heap walk, stepping over
+// the gap from an epilogue to the next segment's first block. Returns the
+// last segment's epilogue once past the end.
+static inline void *walk_next(void *ptr)
+{
+    size_t blocksz = get_blocksz(ptr);
+    if (blocksz != 0 || ptr == epilogue()) return (char *)ptr + blocksz;
+    return seg_start(seg_for(ptr) + 1) + SWORD;
+}
+
+// given block size, find the most suitible index
 // our arr of linked list is: {1}, {2,3}, {4,5,6,7}, {8,...,15}, {16,...,31}, ..., {2^13,...,2^14-1}
-static inline int find_index(int blocksz) 
+static inline int find_index(size_t blocksz)
 {
     return MIN((int)(log2f((float)(blocksz / ALIGNMENT))), BUCKETNUMBER - 1); //EFFICIENCY
 }
 
-// insert a free block to the arr of linked list
-static void insert(void *header) 
+// insert a free block to the front of its bucket's linked list
+static void insert(void *header)
 {
     size_t blocksz = get_blocksz(header);
     int index = find_index(blocksz); // find the index to insert
-    // insert to the front of the linked list
-    if (arr_of_list[index] != 0) { // if not an empty linked list
-        set_succ(header, arr_of_list[index]);
-        set_prev(arr_of_list[index], header);
-        set_prev(header, &arr_of_list[index]);
-        arr_of_list[index] = header;     
-    } else { // empty list before
-        set_succ(header, NULL);
-        set_prev(header, &arr_of_list[index]);   
-        arr_of_list[index] = header;
-    }
-    printf("In insert...\n");
-    validate_heap();
+    set_succ(header, arr_of_list[index]);
+    set_prev(header, &arr_of_list[index]);
+    if (arr_of_list[index] != NULL) set_prev(arr_of_list[index], header);
+    arr_of_list[index] = header;
+    free_total += blocksz;
+    heap_version++;
 }
 
 //passed in header pointer and the index it belongs to, delete it from the free list
-static void delete(void *header, int index) 
+static void delete(void *header, int index)
 {
-    // for (void *curr = arr_of_list[index]; curr != NULL; curr = *(void **)(get_succ(curr))) {
-    //     printf("curr address = %p; curr = %d", curr, *(unsigned int *)curr);
-    // }
-    // printf("-------------------------------------------------------\n");
     void *prev = *(void **)(get_prev(header));
     void *succ = *(void **)(get_succ(header));
-    if (header == arr_of_list[index]) { // first block of this linked list
-        if (succ != NULL) { // is first, not the last
-            arr_of_list[index] = succ;
-            set_prev(succ, prev);
-        } else { // the only block in this list
-            arr_of_list[index] = NULL;
-        }
-    } else if (succ == NULL) { // not first, but the last
+    if (header == arr_of_list[index]) { // first block, prev is the list head itself
+        arr_of_list[index] = succ;
+    } else {
         set_succ(prev, succ);
-    } else { // neither, nor
-        set_succ(prev, succ);
-        set_prev(succ, prev);       
     }
-    printf("In delete... \n");
-    validate_heap();
+    if (succ != NULL) set_prev(succ, prev);
+    free_total -= get_blocksz(header);
+    heap_version++;
 }
 
 // Given a pointer to start of payload, simply back up
@@ -166,192 +298,410 @@ static inline headerT *ftr_for_payload(void *payload)
     return (headerT *)((char *)payload + blocksz - 2 * sizeof(headerT));
 }
 
-static void construct_block(void *ptr, int blocksz, int status) // ptr is pointer to header
+#ifdef ALLOCATOR_CANARY
+// slot at end of payload that records the requested size
+static inline char *canary_slot(void *payload)
+{
+    return (char *)ftr_for_payload(payload) - sizeof(size_t);
+}
+
+// fill the slack after requestedsz with the guard pattern
+static void stamp_canary(void *payload, size_t requestedsz)
+{
+    char *slot = canary_slot(payload);
+    memset((char *)payload + requestedsz, CANARY_BYTE, slot - ((char *)payload + requestedsz));
+    memcpy(slot, &requestedsz, sizeof(size_t));
+}
+
+// verify guard pattern is intact, report and remember any overrun
+static void check_canary(void *payload)
+{
+    char *slot = canary_slot(payload);
+    size_t requestedsz;
+    memcpy(&requestedsz, slot, sizeof(size_t));
+    bool ok = requestedsz <= (size_t)(slot - (char *)payload); // else size slot overwritten
+    unsigned char *guard = ok ? (unsigned char *)payload + requestedsz : (unsigned char *)slot;
+    while (ok && guard < (unsigned char *)slot && *guard == CANARY_BYTE)
+        guard++;
+    if (!ok || guard != (unsigned char *)slot) {
+        fprintf(stderr, "allocator: overrun past end of block %p (guard damaged at %p)\n", payload, guard);
+        canary_tripped = true;
+    }
+}
+#else
+static inline void stamp_canary(void *payload, size_t requestedsz) {}
+static inline void check_canary(void *payload) {}
+#endif
+
+static void construct_block(void *ptr, size_t blocksz, int status) // ptr is pointer to header
 {
     unsigned int header = blocksz + status;
     *(unsigned int *)ptr = header; // make header
     *(unsigned int *)((char *)ptr + blocksz - sizeof(headerT)) = header; // make footer
-} 
+}
 
-// coalesce and change header and footer
+// Merge a newly freed block (not yet in any list) with its physical
+// neighbors. Free neighbors are pulled out of their lists, the pad and
+// epilogue sentinels are always allocated so no bounds checks are needed.
+// A neighbor is left separate if the merged size would not fit in a header,
+// so two free blocks are only ever adjacent when together they exceed
+// MAX_BLOCK. Returns header of the merged block.
 static void *coalesce(void *ptr) // ptr is pointer to header of a block
 {
+    size_t size = get_blocksz(ptr);
+    void *succ = (char *)ptr + size;
+    void *prev_ftr = (char *)ptr - sizeof(headerT);
 
-    int size = get_blocksz(ptr);
-    int old_size = size;
-    int prev_alloc; // physically prev
-    int succ_alloc;// physically succ
-
-    // if ptr is now on the top most of the heap
-    if (ptr == hpptr && numpages * PAGE_SIZE >= size) { 
-          succ_alloc = get_status((char *)ptr + size);
-          if (!succ_alloc) { // only react when physical succ is free
-            size += get_blocksz((char *)ptr + size); // change size
-            // change blocksz in header and footer of the big block
-            *(unsigned int *)ptr = size; // header
-            *(unsigned int *)((char *)ptr + size - sizeof(headerT)) = size; // footer    
-           }
-        return ptr;
-    } else if ( ptr != hpptr && numpages * PAGE_SIZE == size) { 
-    // if ptr is pointing to the last most block on heap
-        prev_alloc = get_status((char *)ptr - sizeof(headerT));
-        if (!prev_alloc) {
-            size += get_blocksz((char *)ptr - sizeof(headerT)); // change size
-            ptr = (char *)ptr - get_blocksz((char *)ptr - sizeof(headerT)); // change ptr to heaeder of physical prev (big block header)
-            // change blocksz in header and footer of the big block
-            *(unsigned int *)ptr = size;
-            *(unsigned int *)((char *)ptr + size - sizeof(headerT)) = size;
-        }
-        return ptr;
-    } else if (ptr == hpptr && numpages * PAGE_SIZE == size) {return ptr; } // the only block on the heap
-
-    // normal case
-    succ_alloc = get_status((char *)ptr + size);
-    prev_alloc = get_status((char *)ptr - sizeof(headerT));
-    // ptr is pointing to a normal block (not the first or last)
-    if (prev_alloc && succ_alloc) {
-        return ptr;
-    } else if (prev_alloc && !succ_alloc) { // prev allocted, succ free
-        size += get_blocksz((char *)ptr + size);
-        // change blocksz in header and footer of the big block
-        *(unsigned int *)ptr = size;
-        *(unsigned int *)((char *)ptr + size - sizeof(headerT)) = size;     
-    } else if (!prev_alloc && succ_alloc) { // prev free, succ allocted
-        size += get_blocksz((char *)ptr - sizeof(headerT));
-        ptr = (char *)ptr - get_blocksz((char *)ptr - sizeof(headerT)); // change ptr
-        // change blocksz in header and footer of the big block
-        *(unsigned int *)ptr = size;
-        *(unsigned int *)((char *)ptr + size - sizeof(headerT)) = size;
-    } else { // prev and succ both free
-        size = size + get_blocksz((char *)ptr + size) + get_blocksz((char *)ptr - sizeof(headerT));
-        ptr = (char *)ptr - get_blocksz((char *)ptr - sizeof(headerT)); // change ptr
-        *(unsigned int *)ptr = size;
-        *(unsigned int *)((char *)ptr + size - sizeof(headerT)) = size;
+    if (!get_status(succ) && size + get_blocksz(succ) <= MAX_BLOCK) { // physical succ is free, absorb it
+        delete(succ, find_index(get_blocksz(succ)));
+        if (slice_cursor == succ) slice_cursor = ptr;
+        if (compact_cursor == succ) compact_cursor = ptr;
+        size += get_blocksz(succ);
+        char *succ_meta_end = (char *)succ + MIN_BLOCK - sizeof(headerT); // its header and links now stale
+        if (fresh_start < succ_meta_end) fresh_start = succ_meta_end;
+    }
+    if (!get_status(prev_ftr) && get_blocksz(prev_ftr) + size <= MAX_BLOCK) { // physical prev is free, absorb into it
+        void *prev = (char *)ptr - get_blocksz(prev_ftr);
+        delete(prev, find_index(get_blocksz(prev)));
+        if (slice_cursor == ptr) slice_cursor = prev;
+        if (compact_cursor == ptr) compact_cursor = prev;
+        size += get_blocksz(prev);
+        ptr = prev;
     }
+    construct_block(ptr, size, 0);
     return ptr;
 }
 
-static void split_n_insert(void *ptr, int blocksz, int size) // size is size needed (rounded up version)
+static void split_n_insert(void *ptr, size_t blocksz, size_t size) // size is size needed (rounded up version)
 {
-    validate_heap();
-    int size1 = size;
-    int size2 = blocksz - size;
-    if (size2 < 3 * ALIGNMENT) { // no need to split if have less than 3 * 8bytes left
-        size1 = blocksz;
-        construct_block(ptr, size1, 1);
+    if (blocksz - size < MIN_BLOCK) { // no need to split if have less than 3 * 8bytes left
+        construct_block(ptr, blocksz, 1);
     } else { // split
-        construct_block(ptr, size1, 1);
-        construct_block((char *)ptr + size1, size2, 0);
-        insert((char *)ptr + size1);
+        construct_block(ptr, size, 1);
+        construct_block((char *)ptr + size, blocksz - size, 0);
+        insert((char *)ptr + size);
     }
 }
 
-static void *find_fit_index(int size, int index) 
+static void *find_fit_index(size_t size, int index)
 {
-    void *curr = arr_of_list[index];
-    while (curr != NULL) { // not an empty linked list
-        // compare size with blocksz
-        // printf("one round in while loop in find_fit_index %d, we want %d, now blocksize = %d\n", index, size, get_blocksz(curr));
-        if (size <= get_blocksz(curr)) {
-            // printf("now delete ....\n");
+    for (void *curr = arr_of_list[index]; curr != NULL; curr = *(void **)(get_succ(curr))) {
+        size_t blocksz = get_blocksz(curr);
+        if (size <= blocksz) {
             delete(curr, index);
-            // printf("now split_n_insert ....\n");
-            split_n_insert(curr, get_blocksz(curr), size);
-            // printf("now return ....\n");
+            split_n_insert(curr, blocksz, size);
             return curr;
         }
-        curr = *(void **)(get_succ(curr));
     }
     // not found
     return NULL;
 }
 
-static void *find_fit(int size)
+// Lays out a new segment like the first, [pad][free block][epilogue], big
+// enough for a block of size bytes. The rest of the last segment stays
+// in the free lists. Returns header of the new free block (not in any list).
+static void *add_segment(size_t size)
 {
-    int index = find_index(size);
-    void *fit = NULL;
-    // find in current index
-    fit = find_fit_index(size, index);
-    if (fit != NULL) return fit;
-    // find in other greater indexes
-    for (int i = index +1; i < BUCKETNUMBER; i++) {
-        fit = find_fit_index(size, i);
+    if (nsegs == MAX_SEGMENTS) return NULL;
+    segment_t *seg = &extra_segs[nsegs - 1];
+    size_t npages = roundup(size + 2 * SWORD, PAGE_SIZE) / PAGE_SIZE;
+    if (hard_limit && heap_bytes() + npages * PAGE_SIZE > hard_limit) return NULL;
+    char *start = segment_init(seg, npages);
+    if (start == NULL) {
+        segment_release(seg);
+        return NULL;
+    }
+    nsegs++;
+    *(unsigned int *)start = 1;
+    *(unsigned int *)epilogue() = 1;
+    construct_block(start + SWORD, npages * PAGE_SIZE - 2 * SWORD, 0);
+    fresh_start = start + SWORD; // fresh_start follows the last segment
+    heap_version++;
+    return start + SWORD;
+}
+
+// Grow the segment enough to hold a block of size bytes, reusing the
+// trailing free block if there is one. Returns header of the new free
+// block (not in any list), or NULL if the segment cannot grow.
+static void *extend(size_t size)
+{
+    void *old_end = epilogue();
+    void *last_ftr = (char *)old_end - sizeof(headerT);
+    size_t sz = get_status(last_ftr) ? 0 : get_blocksz(last_ftr);
+    size_t npages = roundup(size - sz, PAGE_SIZE) / PAGE_SIZE;
+    if (sz + npages * PAGE_SIZE > MAX_BLOCK) { // too big to merge, new pages form a block of their own
+        sz = 0;
+        npages = roundup(size, PAGE_SIZE) / PAGE_SIZE;
+    }
+
+    if (hard_limit && heap_bytes() + npages * PAGE_SIZE > hard_limit) return NULL;
+    if (nsegs == 1 ? extend_heap_segment(npages) == NULL : segment_extend(&extra_segs[nsegs - 2], npages) == NULL)
+        return heap_fd == -1 ? add_segment(size) : NULL; // file heap is one segment
+    if (nsegs == 1) numpages += npages;
+    void *block = (char *)old_end - sz;
+    if (sz != 0) { // old footer and epilogue end up inside merged block, keep it clean
+        delete(block, find_index(sz));
+        memset(last_ftr, 0, 2 * sizeof(headerT));
+    }
+    construct_block(block, sz + npages * PAGE_SIZE, 0);
+    *(unsigned int *)epilogue() = 1; // new epilogue
+    if (slice_cursor == old_end) slice_cursor = block;
+    if (compact_cursor == old_end) compact_cursor = block;
+    heap_version++;
+    return block;
+}
+
+static void *search_lists(size_t size)
+{
+    // find in current index, then in other greater indexes
+    for (int i = find_index(size); i < BUCKETNUMBER; i++) {
+        void *fit = find_fit_index(size, i);
         if (fit != NULL) return fit;
     }
-    int sz = 0;
-    // bool chk_free = 0;
-    void *ptr = NULL;
-    //check if the physically last block is free
-    if (numpages != 0){
-        if (get_status((headerT *)(((char *)hpptr + numpages * PAGE_SIZE) - sizeof(headerT))) == 0) {
-            sz = get_blocksz((headerT *)(((char *)hpptr + numpages * PAGE_SIZE) - sizeof(headerT)));
-            ptr = (char *)hpptr + numpages * PAGE_SIZE - sz; // point to header of the last free block
-        }   
-    }
-    // calculate the number of pages needed
-    int npages = 1;
-    if (index == BUCKETNUMBER - 1) {
-        npages = (size - sz)/PAGE_SIZE + 1;
-    }
-
-    //extend heap
-    fit = extend_heap_segment(npages); 
-    if (fit != NULL) {
-        numpages += npages;
-        int blocksz = npages * PAGE_SIZE;
-        if (ptr != NULL) { // last block from before is free
-            fit = ptr;
-            blocksz += sz;
-        } 
-        printf("---------------blocksz = %d; numpages = %d----------\n", blocksz, numpages);
-        split_n_insert(fit, blocksz, size);      
+    return NULL;
+}
+
+static void notify_pressure(heappressure_t level)
+{
+    if (pressure_fn == NULL || in_pressure) return;
+    in_pressure = true;
+    pressure_fn(level, heap_bytes(), pressure_aux);
+    in_pressure = false;
+}
+
+static void *find_fit(size_t size)
+{
+    if (heap_readonly) return NULL;
+    fit_fresh = fresh_start;
+    void *fit = search_lists(size);
+    if (fit != NULL) return fit;
+    fit = extend(size);
+    if (fit == NULL) { // at hard limit or out of memory, try to make room first
+        heap_purge();
+        notify_pressure(HEAP_HARD_LIMIT);
+        fit_fresh = fresh_start; // callback may have used and freed memory past it
+        if ((fit = search_lists(size)) != NULL) return fit;
+        fit = extend(size);
     }
+    if (fit != NULL) split_n_insert(fit, get_blocksz(fit), size);
     return fit; // pointer to header of fitted block
 }
+
+// Called once a request is complete and the heap is consistent, so the
+// callback can free blocks safely
+static void check_soft_limit(void)
+{
+    if (soft_limit && !soft_signalled && heap_bytes() > soft_limit) {
+        soft_signalled = true;
+        notify_pressure(HEAP_SOFT_LIMIT);
+    }
+}
+
 /* The responsibility of the myinit function is to configure a new
  * empty heap. Typically this function will initialize the
  * segment (you decide the initial number pages to set aside, can be
  * zero if you intend to defer until first request) and set up the
  * global variables for the empty, ready-to-go state. The myinit
- * function is called once at program start, before any allocation 
+ * function is called once at program start, before any allocation
  * requests are made. It may also be called later to wipe out the current
  * heap contents and start over fresh. This "reset" option is specifically
  * needed by the test harness to run a sequence of scripts, one after another,
  * without restarting program from scratch.
  */
+// Resets the state that only describes this process's view of the heap.
+// Cached blocks belong to the heap being replaced, so the caches are just
+// emptied. Canary mode checks every block on free, so it caches nothing.
+static void reset_transient(void)
+{
+    bool cache = !heap_readonly && CANARY_PAD == 0;
+    for (int i = 0; i < FAST_CLASSES; i++)
+        allocator_fast_lists[i] = (fastlist_t){.head = NULL, .count = 0, .limit = cache ? FAST_LIMIT : 0};
+    heap_version++;
+    slice_cursor = NULL;
+    compact_cursor = NULL;
+    soft_signalled = soft_limit && heap_bytes() > soft_limit;
+#ifdef ALLOCATOR_CANARY
+    canary_tripped = false;
+#endif
+}
+
+// Lays out an empty heap in the single page segment at hpptr
+static void format_heap(void)
+{
+    memset(arr_of_list, 0, sizeof(arr_of_list));
+    numpages = 1;
+    free_total = 0;
+    fresh_start = (char *)hpptr + SWORD;
+    heap_root = NULL;
+    handle_table = NULL;
+    handle_count = handle_free_list = 0;
+    *(unsigned int *)hpptr = 1; // pad word doubles as prologue footer
+    *(unsigned int *)epilogue() = 1;
+    void *first = (char *)hpptr + SWORD;
+    construct_block(first, PAGE_SIZE - 2 * SWORD, 0);
+    insert(first);
+}
+
+// Forget about any heap file and give back any segments past the first,
+// the heap has been or is about to be replaced
+static void close_heap_file(void)
+{
+    if (heap_fd != -1) close(heap_fd);
+    heap_fd = -1;
+    heap_readonly = false;
+    for (; nsegs > 1; nsegs--)
+        segment_release(&extra_segs[nsegs - 2]);
+}
+
 bool myinit()
 {
-    hpptr = init_heap_segment(0); // reset heap segment to empty, no pages allocated
-    // arr_of_list = {0}; // initialize arr of linked lists
-    numpages = 0;
+    close_heap_file();
+    hpptr = init_heap_segment(1); // reset heap segment to a single page
+    if (hpptr == NULL) return false;
+    reset_transient();
+    format_heap();
     return true;
 }
 
+// mymalloc without the soft limit check, so mycalloc can clear the block
+// before a callback runs and can still read fit_fresh for this block
+static void *malloc_block(size_t requestedsz)
+{
+    if (requestedsz > MAX_REQUEST) return NULL;
+    size_t size = roundup(requestedsz + CANARY_PAD + 2 * sizeof(headerT), ALIGNMENT); // round up
+    if (size < MIN_BLOCK) size = MIN_BLOCK;
+    void *fit = find_fit(size);
+    // fit might be NULL because extend_heap might return NULL
+    if (fit == NULL) return NULL;
+    char *fit_end = (char *)fit + get_blocksz(fit);
+    if (fresh_start < fit_end) fresh_start = fit_end;
+    stamp_canary(payload_for_hdr(fit), requestedsz);
+    return payload_for_hdr(fit);
+}
+
 void *mymalloc(size_t requestedsz)
 {
-    size_t size = roundup(requestedsz + 2 * sizeof(headerT), ALIGNMENT); // round up 
-    if (size < 3*ALIGNMENT) size = 3*ALIGNMENT;
-    void *fit = find_fit(size); // only worry about extend page here in find_fit function
-    // fit might be NULL because exotend_heap might return NULL
-    return (fit != NULL) ? payload_for_hdr(fit) : NULL; 
-    // headerT *header = extend_heap_segment(npages);
-    // header->payloadsz = requestedsz;
-    // return payload_for_hdr(header);
+    void *ptr = malloc_block(requestedsz);
+    check_soft_limit();
+    return ptr;
+}
+
+void *mycalloc(size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) return NULL; // nmemb*size overflows
+    size_t total = nmemb * size;
+    char *ptr = malloc_block(total);
+    if (ptr == NULL) return NULL;
+    char *dirty_end = ptr + 2 * sizeof(void *); // list links always stale
+    if (dirty_end < fit_fresh) dirty_end = fit_fresh;
+    if (nsegs > 1 && seg_for(ptr) != nsegs - 1) dirty_end = ptr + total; // fresh_start only covers last segment
+    memset(ptr, 0, MIN(total, (size_t)(dirty_end - ptr)));
+    check_soft_limit();
+    return ptr;
 }
 
 void myfree(void *ptr)
 {
-    if (ptr != NULL) { 
+    if (ptr != NULL && !heap_readonly) {
+        check_canary(ptr);
         void *header = hdr_for_payload(ptr);
-        set_status(header, 0); // set allocation status in header
-        set_status(ftr_for_payload(ptr), 0); // set allocation status in Footer
-        header = coalesce(header); 
+        construct_block(header, get_blocksz(header), 0); // clear status in header and footer
+        header = coalesce(header);
         insert(header);
     }
     // if ptr points to NULL, do nothing
 }
 
 
+// Carve each chunk into blocks of blocksz, the last block of a chunk takes
+// any leftover too small to split off. Chunks are capped so their size
+// still fits in a header.
+size_t mymalloc_batch(size_t size, size_t n, void *out[])
+{
+    if (size > MAX_REQUEST) return 0;
+    size_t blocksz = roundup(size + CANARY_PAD + 2 * sizeof(headerT), ALIGNMENT);
+    if (blocksz < MIN_BLOCK) blocksz = MIN_BLOCK;
+    size_t done = 0;
+    while (done < n) {
+        size_t count = MIN(n - done, MAX_REQUEST / blocksz);
+        char *chunk = find_fit(count * blocksz);
+        if (chunk == NULL) break;
+        char *chunk_end = chunk + get_blocksz(chunk);
+        if (fresh_start < chunk_end) fresh_start = chunk_end;
+        for (size_t i = 0; i < count; i++) {
+            char *block = chunk + i * blocksz;
+            construct_block(block, i == count - 1 ? (size_t)(chunk_end - block) : blocksz, 1);
+            out[done + i] = payload_for_hdr((headerT *)block);
+            stamp_canary(out[done + i], size);
+        }
+        done += count;
+    }
+    check_soft_limit();
+    return done;
+}
+
+// Slow path of mymalloc_fixed, class cache is empty. Carves a batch, the
+// first block is returned and the rest go into the cache.
+void *mymalloc_refill(size_t size)
+{
+    fastlist_t *list = &allocator_fast_lists[FAST_CLASS(size)];
+    if (list->limit == 0) return mymalloc(size);
+    void *batch[FAST_BATCH];
+    size_t n = mymalloc_batch(size, FAST_BATCH, batch);
+    if (n == 0) return NULL;
+    for (size_t i = n - 1; i > 0; i--) { // lowest addresses handed out first
+        *(void **)batch[i] = list->head;
+        list->head = batch[i];
+    }
+    list->count += n - 1;
+    return batch[0];
+}
+
+// Empty every class cache back into the free lists
+static void flush_fast_lists(void)
+{
+    for (int i = 0; i < FAST_CLASSES; i++) {
+        fastlist_t *list = &allocator_fast_lists[i];
+        while (list->head != NULL) {
+            void *ptr = list->head;
+            list->head = *(void **)ptr;
+            myfree(ptr);
+        }
+        list->count = 0;
+    }
+}
+
+static int cmp_addr(const void *one, const void *two)
+{
+    char *a = *(char **)one, *b = *(char **)two;
+    return (a > b) - (a < b);
+}
+
+void myfree_batch(void *ptrs[], size_t n)
+{
+    if (heap_readonly) return;
+    size_t i = 1;
+    while (i < n && (char *)ptrs[i - 1] <= (char *)ptrs[i]) i++;
+    if (i < n) qsort(ptrs, n, sizeof(void *), cmp_addr); // NULLs sort first
+    i = 0;
+    while (i < n && ptrs[i] == NULL) i++;
+    while (i < n) {
+        check_canary(ptrs[i]);
+        char *start = (char *)hdr_for_payload(ptrs[i]);
+        char *end = start + get_blocksz(start);
+        for (i++; i < n && (char *)hdr_for_payload(ptrs[i]) == end &&
+                  (size_t)(end - start) + get_blocksz(end) <= MAX_BLOCK; i++) { // extend run
+            check_canary(ptrs[i]);
+            end += get_blocksz(end);
+        }
+        if ((char *)slice_cursor > start && (char *)slice_cursor < end) slice_cursor = start;
+        if ((char *)compact_cursor > start && (char *)compact_cursor < end) compact_cursor = start;
+        construct_block(start, end - start, 0);
+        insert(coalesce(start));
+    }
+}
+
+
 // realloc built on malloc/memcpy/free is easy to write.
 // This code will work ok on ordinary cases, but needs attention
 // to robustness. Realloc efficiency can be improved by
@@ -359,7 +709,8 @@ void myfree(void *ptr)
 // delegating to malloc/free.
 void *myrealloc(void *oldptr, size_t newsz) //EFFICIENCY
 {
-    size_t size = roundup(newsz + 2 * sizeof(headerT), ALIGNMENT); // new block size
+    if (newsz > MAX_REQUEST) return NULL;
+    size_t size = roundup(newsz + CANARY_PAD + 2 * sizeof(headerT), ALIGNMENT); // new block size
     void *newptr = oldptr;
     if (oldptr == NULL) { // Special_Case_1: oldptr == NULL. Same as malloc
         newptr = mymalloc(newsz);
@@ -373,29 +724,573 @@ void *myrealloc(void *oldptr, size_t newsz) //EFFICIENCY
                 newptr = mymalloc(newsz);
                 if (newptr != NULL) {
                     memcpy(newptr, oldptr, (blocksz - 2 * sizeof(headerT)));
+                    stamp_canary(newptr, newsz); // copy clobbered new guard
                     myfree(oldptr);
                 } // else malloc failed do nothing and return NULL(newptr) in the end
-            } // else no need to do anything
+            } else { // fits in place, guard moves to new size
+                check_canary(oldptr);
+                stamp_canary(oldptr, newsz);
+            }
         }
     }
     return newptr;
 }
 
 
+void heap_set_limits(size_t soft, size_t hard)
+{
+    soft_limit = soft;
+    hard_limit = hard;
+    soft_signalled = soft && heap_bytes() > soft;
+}
+
+void heap_set_pressure_callback(pressurefn_t fn, void *aux)
+{
+    pressure_fn = fn;
+    pressure_aux = aux;
+}
+
+// Give back whole pages at the end of the heap held by the trailing free
+// block, leaving it at least MIN_BLOCK so the heap keeps its shape. A
+// segment past the first that is all one free block is given back whole,
+// then the one before it is tried.
+static size_t shrink_tail(void)
+{
+    int last = nsegs - 1;
+    char *last_ftr = (char *)epilogue() - sizeof(headerT);
+    if (get_status(last_ftr)) return 0;
+    char *block = (char *)epilogue() - get_blocksz(last_ftr);
+    char *end = (char *)epilogue() + SWORD;
+    size_t released;
+
+    if (last > 0 && block == seg_start(last) + SWORD) {
+        delete(block, find_index(get_blocksz(block)));
+        released = seg_size(last);
+        segment_release(&extra_segs[last - 1]);
+        nsegs--;
+        block = seg_start(last); // cursors in the released segment end their pass
+        fresh_start = epilogue();
+    } else {
+        char *new_end = (char *)roundup((uintptr_t)block + MIN_BLOCK + SWORD, PAGE_SIZE);
+        if (new_end >= end) return 0;
+        size_t npages = (end - new_end) / PAGE_SIZE;
+        if (last > 0 ? !segment_shrink(&extra_segs[last - 1], npages) : !shrink_heap_segment(npages))
+            return 0;
+        delete(block, find_index(get_blocksz(block)));
+        if (last == 0) numpages -= npages;
+        construct_block(block, (char *)epilogue() - block, 0);
+        *(unsigned int *)epilogue() = 1;
+        insert(block);
+        if (fresh_start > (char *)epilogue() && fresh_start < end) fresh_start = epilogue();
+        released = npages * PAGE_SIZE;
+    }
+    if ((char *)slice_cursor > block && (char *)slice_cursor < end) slice_cursor = epilogue();
+    if ((char *)compact_cursor > block && (char *)compact_cursor < end) compact_cursor = epilogue();
+    if (soft_limit && heap_bytes() <= soft_limit) soft_signalled = false;
+    return nsegs == last ? released + shrink_tail() : released;
+}
+
+// Discard the whole pages inside each free block, keeping the pages that
+// hold its header, list links and footer. Discarded pages read back as
+// zero, which leaves the fresh_start invariant intact.
+size_t heap_purge(void)
+{
+    flush_fast_lists();
+    size_t released = shrink_tail();
+    for (int i = 0; i < BUCKETNUMBER; i++) {
+        for (void *curr = arr_of_list[i]; curr != NULL; curr = *(void **)get_succ(curr)) {
+            char *lo = (char *)roundup((uintptr_t)curr + MIN_BLOCK - SWORD, PAGE_SIZE);
+            char *hi = (char *)(((uintptr_t)curr + get_blocksz(curr) - SWORD) & ~(uintptr_t)(PAGE_SIZE - 1));
+            int seg = seg_for(lo);
+            if (hi > lo && (seg > 0 ? segment_discard(&extra_segs[seg - 1], lo, (hi - lo) / PAGE_SIZE)
+                                  : discard_heap_pages(lo, (hi - lo) / PAGE_SIZE)))
+                released += hi - lo;
+        }
+    }
+    return released;
+}
+
+
+// Handle index at the front of a movable block's payload
+static inline size_t *handle_slot(void *header)
+{
+    return (size_t *)((char *)header + sizeof(headerT));
+}
+
+// Allocates or resizes a movable block, given and returning the address
+// of its client data, which follows the handle index. The index of a
+// new block is left for the caller to fill in.
+static void *handle_block(void *data, size_t size)
+{
+    if (size > MAX_REQUEST) return NULL;
+    size_t *payload = data ? (size_t *)data - 1 : NULL;
+    size_t *moved = myrealloc(payload, size + sizeof(size_t));
+    if (moved == NULL) return NULL;
+    if (moved != payload) // fresh block from mymalloc, not yet marked
+        construct_block(hdr_for_payload(moved), get_blocksz(hdr_for_payload(moved)), 1 | MOVABLE);
+    return moved + 1;
+}
+
+// Doubles the table, chaining the new entries onto the unused list. The
+// table is a movable block too, under the otherwise unused handle 0, so
+// it does not get in the way of compaction.
+static bool grow_handles(void)
+{
+    size_t count = handle_count ? 2 * handle_count : 64;
+    handle_entry *table = handle_block(handle_table, count * sizeof(handle_entry));
+    if (table == NULL) return false;
+    if (handle_table == NULL) *((size_t *)table - 1) = 0;
+    for (size_t i = MAX(handle_count, 1); i < count; i++)
+        table[i] = (handle_entry){.ptr = NULL, .pins = 0, .next = i + 1 < count ? i + 1 : 0};
+    handle_free_list = MAX(handle_count, 1);
+    handle_table = table;
+    handle_count = count;
+    return true;
+}
+
+handle_t handle_alloc(size_t size)
+{
+    if (heap_readonly || (handle_free_list == 0 && !grow_handles())) return 0;
+    size_t h = handle_free_list;
+    void *ptr = handle_block(NULL, size);
+    if (ptr == NULL) return 0;
+    *((size_t *)ptr - 1) = h;
+    handle_free_list = handle_table[h].next;
+    handle_table[h] = (handle_entry){.ptr = ptr, .pins = 0, .next = 0};
+    return h;
+}
+
+// Done in place if the block can stay, else the data is copied to a new
+// block, like myrealloc, even if the handle is pinned
+bool handle_realloc(handle_t h, size_t size)
+{
+    void *ptr = handle_block(handle_table[h].ptr, size);
+    if (ptr == NULL) return false;
+    handle_table[h].ptr = ptr;
+    return true;
+}
+
+void handle_free(handle_t h)
+{
+    if (h == 0 || heap_readonly) return;
+    myfree((size_t *)handle_table[h].ptr - 1);
+    handle_table[h] = (handle_entry){.ptr = NULL, .pins = 0, .next = handle_free_list};
+    handle_free_list = h;
+}
+
+void *handle_get(handle_t h)
+{
+    return h ? handle_table[h].ptr : NULL;
+}
+
+void *handle_pin(handle_t h)
+{
+    handle_table[h].pins++;
+    return handle_table[h].ptr;
+}
+
+void handle_unpin(handle_t h)
+{
+    handle_table[h].pins--;
+}
+
+// One step of compaction at compact_cursor. A free block followed by an
+// unpinned movable block swaps places with it: the data slides down, the
+// free space moves up and merges with whatever free block follows. Anything
+// else just advances the cursor. Returns false once the cursor reaches the
+// end of the heap.
+static bool compact_step(void)
+{
+    char *block = compact_cursor;
+    if (block == epilogue()) return false;
+    size_t size = get_blocksz(block);
+    if (size == 0) { // epilogue of an earlier segment
+        compact_cursor = walk_next(block);
+        return true;
+    }
+    char *next = block + size;
+    if (get_status(block) || !(*(unsigned int *)next & MOVABLE) ||
+        (*handle_slot(next) != 0 && handle_table[*handle_slot(next)].pins > 0)) {
+        compact_cursor = get_status(block) ? next : next + get_blocksz(next);
+        return true;
+    }
+    size_t nextsz = get_blocksz(next);
+    delete(block, find_index(size));
+    memmove(block, next, nextsz); // header and footer come along
+    if (*handle_slot(block) == 0) // the table itself
+        handle_table = (handle_entry *)(handle_slot(block) + 1);
+    else
+        handle_table[*handle_slot(block)].ptr = handle_slot(block) + 1;
+    if (slice_cursor == next) slice_cursor = block;
+    char *hole = block + nextsz;
+    construct_block(hole, size, 0);
+    compact_cursor = hole; // may be merged away, coalesce retargets cursor
+    insert(coalesce(hole));
+    return true;
+}
+
+// The clock is read every few steps, as a step is much cheaper than a read
+bool heap_compact(unsigned int budget_us)
+{
+    if (heap_readonly) return true;
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (compact_cursor == NULL) compact_cursor = (char *)hpptr + SWORD;
+    for (unsigned int steps = 1; compact_step(); steps++) {
+        if (budget_us > 0 && steps % 32 == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 >= budget_us)
+                return false;
+        }
+    }
+    compact_cursor = NULL;
+    heap_purge();
+    return true;
+}
+
+
+void heap_set_root(void *ptr)
+{
+    heap_root = ptr;
+}
+
+void *heap_get_root(void)
+{
+    return heap_root;
+}
+
+// write all of buf at offset, retrying short writes
+static bool write_all(int fd, const void *buf, size_t len, off_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n <= 0) return false;
+        buf = (const char *)buf + n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Header describing the heap as it stands
+static void fill_snapshot(snapshot_t *snap)
+{
+    *snap = (snapshot_t){.magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION, .base = hpptr,
+                         .npages = numpages, .free_total = free_total,
+                         .fresh_offset = fresh_start - (char *)hpptr, .root = heap_root,
+                         .handles = handle_table, .handle_count = handle_count,
+                         .handle_free_list = handle_free_list};
+    memcpy(snap->lists, arr_of_list, sizeof(arr_of_list));
+}
+
+// Pages past fresh_start are zero but for the last one (trailing footer
+// and epilogue), so they are left as a hole in the file.
+bool heap_snapshot(const char *path)
+{
+    if (nsegs > 1) return false; // format holds one segment
+    flush_fast_lists(); // cache is not saved
+    snapshot_t snap;
+    fill_snapshot(&snap);
+    size_t size = (size_t)numpages * PAGE_SIZE;
+    size_t used = MIN(roundup(snap.fresh_offset, PAGE_SIZE), size - PAGE_SIZE);
+
+    char tmp[strlen(path) + 5];
+    sprintf(tmp, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd == -1) return false;
+    bool ok = write_all(fd, &snap, sizeof(snap), 0) &&
+              write_all(fd, hpptr, used, PAGE_SIZE) &&
+              write_all(fd, (char *)hpptr + size - PAGE_SIZE, PAGE_SIZE, size) &&
+              fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok && rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+// Reads and checks the snapshot header of the file open on fd, then maps
+// the saved segment back at its original address. Takes over the heap
+// from snapshot on success.
+static bool attach_snapshot(int fd, bool shared, bool writable)
+{
+    snapshot_t snap;
+    struct stat st;
+    if (pread(fd, &snap, sizeof(snap), 0) != sizeof(snap) ||
+        memcmp(snap.magic, SNAPSHOT_MAGIC, sizeof(snap.magic)) != 0 ||
+        snap.version != SNAPSHOT_VERSION || snap.npages == 0 || fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < (snap.npages + 1) * (size_t)PAGE_SIZE || // file cut since header written
+        attach_heap_segment(fd, PAGE_SIZE, snap.npages, shared, writable) != snap.base)
+        return false;
+    hpptr = snap.base;
+    numpages = snap.npages;
+    memcpy(arr_of_list, snap.lists, sizeof(arr_of_list));
+    if (writable) // first block links back to list head, which may have moved
+        for (int i = 0; i < BUCKETNUMBER; i++)
+            if (arr_of_list[i] != NULL) set_prev(arr_of_list[i], &arr_of_list[i]);
+    free_total = snap.free_total;
+    fresh_start = (char *)hpptr + snap.fresh_offset;
+    heap_root = snap.root;
+    handle_table = snap.handles;
+    handle_count = snap.handle_count;
+    handle_free_list = snap.handle_free_list;
+    reset_transient();
+    return true;
+}
+
+bool heap_restore(const char *path)
+{
+    close_heap_file();
+    int fd = open(path, O_RDONLY);
+    bool ok = fd != -1 && attach_snapshot(fd, false, true);
+    if (fd != -1) close(fd); // mapping stays valid after close
+    if (!ok) myinit();
+    return ok;
+}
+
+// A new file gets an empty one page heap, which is checkpointed so that
+// the file is valid from the start
+bool heap_open_file(const char *path, bool writable)
+{
+    close_heap_file();
+    heap_readonly = !writable;
+    int fd = open(path, writable ? O_RDWR|O_CREAT : O_RDONLY, 0644);
+    struct stat st;
+    bool ok = fd != -1 && fstat(fd, &st) == 0;
+    if (ok && st.st_size == 0 && writable) {
+        ok = ftruncate(fd, 2 * PAGE_SIZE) == 0 &&
+             (hpptr = attach_heap_segment(fd, PAGE_SIZE, 1, true, true)) != NULL;
+        if (ok) {
+            heap_fd = fd;
+            reset_transient();
+            format_heap();
+            ok = heap_checkpoint();
+        }
+    } else if (ok) {
+        ok = attach_snapshot(fd, true, writable);
+    }
+    if (!ok) {
+        if (fd != -1) close(fd);
+        heap_fd = -1;
+        myinit();
+        return false;
+    }
+    if (writable)
+        heap_fd = fd;
+    else
+        close(fd);
+    return true;
+}
+
+// Data pages go out before the header that describes them, so the header
+// on disk never refers to pages that have not been written
+bool heap_checkpoint(void)
+{
+    if (heap_fd == -1) return false;
+    flush_fast_lists();
+    snapshot_t snap;
+    fill_snapshot(&snap);
+    return sync_heap_segment() && write_all(heap_fd, &snap, sizeof(snap), 0) && fdatasync(heap_fd) == 0;
+}
+
+
+size_t heap_total_size(void)
+{
+    return heap_bytes();
+}
+
+bool heap_contains(void *ptr, size_t size)
+{
+    int i = seg_for(ptr);
+    return i >= 0 && (char *)ptr + size <= seg_start(i) + seg_size(i);
+}
+
+// Report free storage per bucket by walking each free list
+void heap_stats(heapstats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->nclasses = BUCKETNUMBER;
+    for (int i = 0; i < BUCKETNUMBER; i++) {
+        for (void *curr = arr_of_list[i]; curr != NULL; curr = *(void **)get_succ(curr)) {
+            size_t blocksz = get_blocksz(curr);
+            stats->class_free[i] += blocksz;
+            stats->free_bytes += blocksz;
+            if (blocksz > stats->largest_free) stats->largest_free = blocksz;
+        }
+    }
+}
+
+
+// report a heap inconsistency on stderr, always returns false
+static bool heap_error(const char *format, ...)
+{
+    va_list args;
+    fprintf(stderr, "validate_heap: ");
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    return false;
+}
+
+// true if ptr is the header of a block somewhere between pad and epilogue
+// of one of the segments
+static inline bool in_heap(void *ptr)
+{
+    for (int i = 0; i < nsegs; i++)
+        if ((char *)ptr > seg_start(i) && (char *)ptr < (char *)seg_epilogue(i)) return true;
+    return false;
+}
+
+// true if ptr is one of the list heads in arr_of_list
+static inline bool is_list_head(void *ptr)
+{
+    return (void **)ptr >= arr_of_list && (void **)ptr < arr_of_list + BUCKETNUMBER;
+}
+
+// Checks the sentinels and that the heap bookkeeping agrees with the segment
+static bool check_bounds(void)
+{
+    if (hpptr != heap_segment_start() || (size_t)numpages * PAGE_SIZE != heap_segment_size())
+        return heap_error("heap %p (%d pages) does not match segment %p (%zu bytes)",
+                          hpptr, numpages, heap_segment_start(), heap_segment_size());
+    for (int i = 0; i < nsegs; i++)
+        if (*(unsigned int *)seg_start(i) != 1 || *(unsigned int *)seg_epilogue(i) != 1)
+            return heap_error("pad or epilogue sentinel of segment %d overwritten", i);
+    return true;
+}
+
+// Checks the list links of free block ptr are consistent with its
+// neighbors in the list, and that it sits in the bucket for its size.
+// Every check is local, so the cost does not depend on the list length.
+static bool check_links(void *ptr)
+{
+    int index = find_index(get_blocksz(ptr));
+    void *prev = *(void **)get_prev(ptr);
+    void *succ = *(void **)get_succ(ptr);
+
+    if (is_list_head(prev)) {
+        if (prev != &arr_of_list[index])
+            return heap_error("free block %p of size %zu is in bucket %d, belongs in %d",
+                              ptr, get_blocksz(ptr), (int)((void **)prev - arr_of_list), index);
+        if (arr_of_list[index] != ptr)
+            return heap_error("free block %p claims to be first in bucket %d", ptr, index);
+    } else {
+        if (!in_heap(prev) || get_status(prev))
+            return heap_error("free block %p has bad prev link %p", ptr, prev);
+        if (*(void **)get_succ(prev) != ptr)
+            return heap_error("free block %p prev %p does not link back", ptr, prev);
+        if (find_index(get_blocksz(prev)) != index)
+            return heap_error("free block %p linked with %p from another bucket", ptr, prev);
+    }
+    if (succ != NULL) {
+        if (!in_heap(succ) || get_status(succ))
+            return heap_error("free block %p has bad succ link %p", ptr, succ);
+        if (*(void **)get_prev(succ) != ptr)
+            return heap_error("free block %p succ %p does not link back", ptr, succ);
+    }
+    return true;
+}
+
+// Checks a single block found by walking the heap: sane size, inside the
+// segment, header agrees with footer, and a free block must not follow
+// another free block (unless the two are too big to merge) and must be
+// properly linked into its bucket.
+static bool check_block(void *ptr)
+{
+    size_t blocksz = get_blocksz(ptr);
+    if (blocksz < MIN_BLOCK || blocksz % ALIGNMENT != 0)
+        return heap_error("block %p has bad size %zu", ptr, blocksz);
+    if ((char *)ptr + blocksz > (char *)seg_epilogue(seg_for(ptr)))
+        return heap_error("block %p of size %zu runs past end of its segment", ptr, blocksz);
+    if (*(unsigned int *)ptr != *(unsigned int *)((char *)ptr + blocksz - sizeof(headerT)))
+        return heap_error("block %p header and footer disagree", ptr);
+    if (!get_status(ptr)) {
+        void *prev_ftr = (char *)ptr - sizeof(headerT);
+        if (!get_status(prev_ftr) && get_blocksz(prev_ftr) + blocksz <= MAX_BLOCK)
+            return heap_error("free block %p follows another free block", ptr);
+        return check_links(ptr);
+    }
+    if (*(unsigned int *)ptr & MOVABLE) { // handle must point back at block
+        size_t h = *handle_slot(ptr);
+        void *expected = h == 0 ? (void *)handle_table : h < handle_count ? handle_table[h].ptr : NULL;
+        if (expected != handle_slot(ptr) + 1)
+            return heap_error("movable block %p has bad handle %zu", ptr, h);
+    }
+    return true;
+}
+
 // validate_heap is your debugging routine to detect/report
-// on problems/inconsistency within your heap data structures
+// on problems/inconsistency within your heap data structures.
+// Walks every block in address order, then every free list, and checks
+// the free bytes found both ways agree. Cost is O(heap).
 bool validate_heap()
 {
+#ifdef ALLOCATOR_CANARY
+    if (canary_tripped) return false;
+#endif
+    if (!check_bounds()) return false;
+
+    size_t walk_free = 0, walk_count = 0;
+    for (int i = 0; i < nsegs; i++) {
+        for (void *ptr = seg_start(i) + SWORD; ptr != seg_epilogue(i); ptr = (char *)ptr + get_blocksz(ptr)) {
+            if (!check_block(ptr)) return false;
+            if (!get_status(ptr)) {
+                walk_free += get_blocksz(ptr);
+                walk_count++;
+            }
+        }
+    }
+
+    size_t list_free = 0, list_count = 0;
     for (int i = 0; i < BUCKETNUMBER; i++) {
-      int count = 0;
-      void * curr = arr_of_list[i];
-      while (curr != NULL) {
-        count++;
-        printf("Bucket %d: block size: %d\n", i, get_blocksz(curr));
-        curr = *(void**)get_succ(curr);
-      }
-      printf("%d in bucket %d\n", count, i);
-    } 
+        for (void *curr = arr_of_list[i]; curr != NULL; curr = *(void **)get_succ(curr)) {
+            if (!in_heap(curr) || get_status(curr))
+                return heap_error("bucket %d holds %p, not a free block", i, curr);
+            if (++list_count > walk_count) // also stops a cyclic list
+                return heap_error("free lists hold more blocks than the heap (%zu)", walk_count);
+            list_free += get_blocksz(curr);
+        }
+    }
+    if (list_count != walk_count || list_free != walk_free || walk_free != free_total)
+        return heap_error("free bytes disagree: heap walk %zu in %zu blocks, lists %zu in %zu blocks, counter %zu",
+                          walk_free, walk_count, list_free, list_count, free_total);
     return true;
 }
 
+// Incremental version of validate_heap, checks at most budget blocks per
+// call and picks up where the last call stopped. The per-block checks are
+// the same as a full walk. When a pass reaches the end of the heap without
+// the free lists having changed since it began, its free byte total is
+// compared to the list total too.
+bool validate_heap_slice(size_t budget)
+{
+#ifdef ALLOCATOR_CANARY
+    if (canary_tripped) return false;
+#endif
+    if (slice_cursor == NULL) { // start new pass
+        if (!check_bounds()) return false;
+        slice_cursor = (char *)hpptr + SWORD;
+        slice_free = 0;
+        slice_version = heap_version;
+    }
+    for (; budget > 0; budget--) {
+        if (slice_cursor == epilogue()) { // pass complete
+            bool unchanged = (slice_version == heap_version);
+            slice_cursor = NULL;
+            if (unchanged && slice_free != free_total)
+                return heap_error("free bytes disagree: heap walk %zu, lists %zu", slice_free, free_total);
+            return true;
+        }
+        int seg = seg_for(slice_cursor);
+        if (seg >= 0 && slice_cursor == seg_epilogue(seg)) { // on to next segment
+            slice_cursor = walk_next(slice_cursor);
+            continue;
+        }
+        if (!in_heap(slice_cursor) || !check_block(slice_cursor)) {
+            slice_cursor = NULL;
+            return false;
+        }
+        if (!get_status(slice_cursor)) slice_free += get_blocksz(slice_cursor);
+        slice_cursor = (char *)slice_cursor + get_blocksz(slice_cursor);
+    }
+    return true;
+}
@@ -34,6 +34,15 @@ void *mymalloc(size_t size);
 void *myrealloc(void *ptr, size_t size);
 
 
+/* Function: mycalloc
+ * ------------------
+ * Custom version of calloc. Returns NULL if nmemb*size overflows. Memory
+ * that comes from freshly extended pages is known to be zero already and
+ * is not cleared again, so a large calloc does not touch its pages.
+ */
+void *mycalloc(size_t nmemb, size_t size);
+
+
 /* Function: myfree
  * ----------------
  * Custom version of free.
@@ -41,6 +50,272 @@ void *myrealloc(void *ptr, size_t size);
 void myfree(void *ptr);
 
 
+/* Function: mymalloc_batch
+ * ------------------------
+ * Allocates n blocks of size bytes each, storing them into out[0..n-1].
+ * The blocks are carved from one free chunk, so a batch costs a single
+ * free list operation instead of n. Returns the number of blocks
+ * allocated, which is less than n only if the heap is exhausted.
+ */
+size_t mymalloc_batch(size_t size, size_t n, void *out[]);
+
+
+/* Function: myfree_batch
+ * ----------------------
+ * Frees n blocks at once (NULL entries are ignored). Sorts ptrs by address
+ * in place unless already in order, then frees each run of physically
+ * adjacent blocks as a single block, so a run costs one coalesce and one
+ * list insert.
+ */
+void myfree_batch(void *ptrs[], size_t n);
+
+
+/* Functions: mymalloc_fixed, myfree_fixed, MYNEW
+ * -----------------------------------------------
+ * Fast path for small blocks of a size known at compile time, such as
+ * mymalloc_fixed(sizeof(cell)) or MYNEW(cell). The size class is then a
+ * constant, and an allocation just pops a block from that class's cache
+ * of freed blocks. Only when the cache is empty does it call into the
+ * allocator, which refills the cache from a batch. myfree_fixed pushes
+ * the block back onto its class's cache, up to a limit per class. It reads
+ * the block size from the header, so it can free any block from mymalloc,
+ * and blocks from mymalloc_fixed can be freed with myfree or passed to
+ * myrealloc. Cached blocks count as in use to validate_heap and
+ * heap_stats, and heap_purge hands them back to the free lists.
+ */
+#define FAST_CLASSES 32     // block sizes 24, 32, .. 272 bytes
+#define FAST_CLASS(size) ((size) <= 16 ? 0 : ((size) + 15) / 8 - 3)
+
+typedef struct {
+    void *head;             // cached blocks, linked through first word of payload
+    unsigned int count, limit;  // limit is 0 when caching is off (canary mode)
+} fastlist_t;
+extern fastlist_t allocator_fast_lists[FAST_CLASSES];
+
+void *mymalloc_refill(size_t size);
+
+static inline void *mymalloc_fixed(size_t size)
+{
+    if (FAST_CLASS(size) >= FAST_CLASSES) return mymalloc(size);
+    fastlist_t *list = &allocator_fast_lists[FAST_CLASS(size)];
+    void *ptr = list->head;
+    if (ptr == NULL) return mymalloc_refill(size);
+    list->head = *(void **)ptr;
+    list->count--;
+    return ptr;
+}
+
+static inline void myfree_fixed(void *ptr)
+{
+    if (ptr == NULL) return;
+    unsigned int cls = (*((unsigned int *)ptr - 1) & ~0x7) / 8 - 3; // from 4-byte header
+    if (cls >= FAST_CLASSES || allocator_fast_lists[cls].count >= allocator_fast_lists[cls].limit) {
+        myfree(ptr);
+        return;
+    }
+    fastlist_t *list = &allocator_fast_lists[cls];
+    *(void **)ptr = list->head;
+    list->head = ptr;
+    list->count++;
+}
+
+#define MYNEW(type) ((type *)mymalloc_fixed(sizeof(type)))
+
+
+/* Type: heappressure_t, pressurefn_t
+ * ---------------------------------
+ * A pressure callback is told which limit was hit and the current heap
+ * size in bytes. It is expected to release memory (free cached objects,
+ * shrink tables) with myfree. aux is the pointer given at registration.
+ */
+typedef enum { HEAP_SOFT_LIMIT, HEAP_HARD_LIMIT } heappressure_t;
+typedef void (*pressurefn_t)(heappressure_t level, size_t heap_size, void *aux);
+
+
+/* Function: heap_set_limits
+ * -------------------------
+ * Sets limits on the size of the heap segment in bytes, 0 meaning no
+ * limit. When the heap first grows past soft, the pressure callback is
+ * called (once, until the heap drops back below soft). The heap never
+ * grows past hard. A request that would need to is retried after a
+ * heap_purge and a call to the pressure callback, and only then fails.
+ * Limits stay in effect across myinit.
+ */
+void heap_set_limits(size_t soft, size_t hard);
+
+
+/* Function: heap_set_pressure_callback
+ * ------------------------------------
+ * Registers fn (NULL to remove) to be called when a heap limit is reached.
+ */
+void heap_set_pressure_callback(pressurefn_t fn, void *aux);
+
+
+/* Function: heap_purge
+ * --------------------
+ * Returns free memory to the OS: the pages inside free blocks are
+ * discarded and free pages at the end of the heap are given back,
+ * shrinking the segment. Returns number of bytes released.
+ */
+size_t heap_purge(void);
+
+
+/* Type: handle_t
+ * --------------
+ * A handle names a movable block. The block's address may change at any
+ * call to heap_compact, so a client keeps the handle and asks for the
+ * current address with handle_get when it needs one. Handle 0 is never
+ * a valid block.
+ */
+typedef size_t handle_t;
+
+
+/* Function: handle_alloc
+ * ----------------------
+ * Allocates a movable block of size bytes. Returns 0 if out of memory.
+ */
+handle_t handle_alloc(size_t size);
+
+
+/* Function: handle_realloc
+ * ------------------------
+ * Resizes the block for h, keeping its contents as myrealloc does. The
+ * handle stays the same. Returns false, leaving the block as it was, if
+ * out of memory.
+ */
+bool handle_realloc(handle_t h, size_t size);
+
+
+/* Function: handle_free
+ * ---------------------
+ * Frees the block for h, which must not be used again. Does nothing if h is 0.
+ */
+void handle_free(handle_t h);
+
+
+/* Functions: handle_get, handle_pin, handle_unpin
+ * -----------------------------------------------
+ * handle_get returns the current address of the block for h, which is good
+ * until the next call to heap_compact or handle_realloc. A pinned block is
+ * never moved by heap_compact, so the address returned by handle_pin stays
+ * good until the matching handle_unpin. Pins nest.
+ */
+void *handle_get(handle_t h);
+void *handle_pin(handle_t h);
+void handle_unpin(handle_t h);
+
+
+/* Function: heap_compact
+ * ----------------------
+ * Compacts the heap by sliding unpinned handle blocks down into the free
+ * space below them, so that free space collects at the end of the heap.
+ * Blocks from mymalloc never move, so free space also collects just below
+ * each of them. A completed pass ends with heap_purge, which gives the
+ * end of the heap and the pages inside those large free blocks back to
+ * the OS.
+ * Runs for about budget_us microseconds and picks up where it left off on
+ * the next call (budget 0 means no limit). Returns true once a whole pass
+ * over the heap is done.
+ */
+bool heap_compact(unsigned int budget_us);
+
+
+/* Functions: heap_set_root, heap_get_root
+ * ----------------------------------------
+ * The root is a single pointer kept with the heap, so that a program can
+ * find its data again after heap_restore. It is saved by heap_snapshot
+ * and cleared by myinit.
+ */
+void heap_set_root(void *ptr);
+void *heap_get_root(void);
+
+
+/* Function: heap_snapshot
+ * -----------------------
+ * Writes the heap contents and allocator state to the file at path,
+ * replacing it atomically. Returns true on success. Only the heap is
+ * saved, so data structures must not point outside it.
+ */
+bool heap_snapshot(const char *path);
+
+
+/* Function: heap_restore
+ * ----------------------
+ * Replaces the current heap with one saved by heap_snapshot. The saved
+ * segment is mapped back at its original address, copy-on-write, so
+ * restore costs no reading or parsing, pages come in as they are touched.
+ * Returns false if the file is not a valid snapshot or the segment cannot
+ * be placed at the same address, in which case the heap is left empty
+ * as after myinit.
+ */
+bool heap_restore(const char *path);
+
+
+/* Function: heap_open_file
+ * -------------------------
+ * Replaces the current heap with one kept in the file at path, in the
+ * same format heap_snapshot writes. The segment is a shared mapping of
+ * the file, so the file holds the heap's current contents at all times and
+ * several processes can map it through the same page cache. If writable,
+ * a missing or empty file is set up as an empty heap, and the file grows
+ * with the heap. Otherwise the heap is read-only: mymalloc returns NULL and
+ * myfree does nothing. The file is only reopened as of the last call to
+ * heap_checkpoint, so a writer should checkpoint before it exits. Returns
+ * false on failure, leaving the heap empty as after myinit. Calling myinit
+ * detaches from the file.
+ */
+bool heap_open_file(const char *path, bool writable);
+
+
+/* Function: heap_checkpoint
+ * -------------------------
+ * Makes the current state of a heap opened writable with heap_open_file
+ * durable: all changed pages are written back, then the header that lets
+ * the file be opened again. Readers that open the file afterwards see
+ * the heap as of this checkpoint. Returns false on failure, or if the heap
+ * is not file-backed.
+ */
+bool heap_checkpoint(void);
+
+
+/* Functions: heap_total_size, heap_contains
+ * ------------------------------------------
+ * The heap starts in the default heap segment and, once that is full,
+ * continues in further segments wherever the OS has room. heap_total_size
+ * returns the bytes in all of them, which is what heap limits are checked
+ * against. heap_contains returns true if the size bytes at ptr lie within
+ * one segment. A heap that has grown past one segment cannot be saved
+ * with heap_snapshot, and a file-backed heap never does.
+ */
+size_t heap_total_size(void);
+bool heap_contains(void *ptr, size_t size);
+
+
+/* Type: heapstats_t
+ * -----------------
+ * Snapshot of the free storage currently held by the allocator, as filled in
+ * by heap_stats. Free bytes are broken down by the allocator's size classes
+ * (class i holds blocks of at least 8*2^i bytes), nclasses says how many of
+ * the class_free entries are in use.
+ */
+#define HEAP_STATS_CLASSES 16
+
+typedef struct {
+    size_t free_bytes;                      // total bytes held in free blocks
+    size_t largest_free;                    // size of largest single free block
+    size_t class_free[HEAP_STATS_CLASSES];  // free bytes held in each size class
+    int nclasses;                           // number of size classes reported
+} heapstats_t;
+
+
+/* Function: heap_stats
+ * --------------------
+ * Fills in stats for the current state of the heap. Walks the free lists,
+ * so the cost is proportional to the number of free blocks.
+ */
+void heap_stats(heapstats_t *stats);
+
+
 /* Function: validate_heap
  * -----------------------
  * This is the hook for your heap consistency checker. Returns true
@@ -48,4 +323,15 @@ void myfree(void *ptr);
  */
 bool validate_heap(void);
 
+
+/* Function: validate_heap_slice
+ * -----------------------------
+ * Incremental form of validate_heap for use where a full O(heap) check
+ * on every call would be too slow. Each call checks at most budget blocks,
+ * continuing from where the previous call stopped and starting over at
+ * the beginning once the whole heap has been covered. Returns true
+ * if all is well in the part checked, false on any problem.
+ */
+bool validate_heap_slice(size_t budget);
+
 #endif
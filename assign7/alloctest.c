@@ -11,20 +11,30 @@
 #define _GNU_SOURCE
 #include <dirent.h>
 #include <limits.h>
+#include <math.h>
+#include <search.h>
 #include <stdio.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <valgrind/callgrind.h>
 
 #include "allocator.h"
+#include "bump.h"
 #include "fcyc.h"
 #include "segment.h"
+#include "threadheap.h"
 
 // Alignment requirement
 #define ALIGNMENT 8
@@ -34,12 +44,38 @@
 
 // default path for test scripts
 #define DEFAULT_SCRIPT_DIR "/afs/ir/class/cs107/samples/assign7/"
+// fallback when default path is unreachable, generated by "make suite"
+#define LOCAL_SCRIPT_DIR "samples"
 #define MAX_SCRIPTS 100
 
 // Throughput (in Kreq/sec) of the reference malloc on standard myth on samples
 // This constant is the stable target allocator throughput is ranked against
 #define TARGET_THRUPUT      12000
 
+// Latency histograms are log-linear (HDR-style): each power of two is split
+// into HIST_SUB_COUNT linear sub-buckets, which bounds relative error to ~6%
+#define HIST_SUB_BITS   4
+#define HIST_SUB_COUNT  (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+#define NUM_OPS         3   // one histogram per request type (alloc/free/realloc)
+
+// Number of evenly spaced points at which the heap timeline is sampled per script
+#define TIMELINE_SAMPLES 200
+
+// Thresholds used when comparing results against a baseline. A throughput change
+// is flagged when larger than REGRESS_PCT and significant by Welch's t-test
+// (|t| above REGRESS_T), a utilization drop when larger than REGRESS_UTIL.
+// With a single run on either side, the change must also exceed REGRESS_NOISE,
+// the typical run-to-run noise that samples within one run do not capture.
+#define REGRESS_PCT     2.0
+#define REGRESS_T       2.0
+#define REGRESS_UTIL    0.005
+#define REGRESS_NOISE   5.0
+
+#define MAX_RUNS        10
+
+#define MAX_BACKENDS    8
+
 // struct for a single allocator request
 typedef struct {
     enum {ALLOC=1, FREE, REALLOC} op;	// type of request
@@ -61,14 +97,15 @@ typedef struct {
     int num_ops;		// number of requests
     int num_ids;		// number of distinct block ids
     block_t *blocks;    // array of blocks returned by malloc when executing
+    void *shadow;       // tsearch tree of live blocks ordered by address, for overlap checks
 } script_t;
 
-// packs the params to the speed function to be timed by fcyc.
-// timed function must take single void * client data pointer
+// Histogram of per-request latencies, measured in timer ticks
 typedef struct {
-    script_t *script;
-    double *utilization;
-} perfdata_t;
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;     // number of samples recorded
+    uint64_t max;       // exact largest sample
+} histogram_t;
 
 // Result from executing a script
 typedef struct {
@@ -78,18 +115,100 @@ typedef struct {
     double secs;		// number of secs needed to execute the script
     double utilization;	// mem utilization  (percent of heap storage in use)
     int tput;           // expressed in Kreq/sec
+    int nsamples;       // number of timing samples taken
+    double secs_mean, secs_stddev;  // across all timing samples
+    long peak_rss_kb;   // peak resident set size of process (backend comparison only)
+    bool has_counters;  // hardware counters below recorded (perf timer only)
+    double ipc;         // instructions per cycle
+    double cache_misses, dtlb_misses;  // per request, -1 if not counted
+    histogram_t *latency;   // per-op histograms indexed by op-1 (NULL unless latency run)
 } result_t;
 
-typedef enum { Correctness = 1, Performance = 2 } flags_t;
+typedef enum { Correctness = 1, Performance = 2, Latency = 4 } flags_t;
+
+// An allocator that scripts can be replayed against. Requests go through the
+// function pointers, so every backend pays the same indirect call cost.
+typedef struct {
+    const char *name;
+    bool (*init)(void);             // reset to empty heap, false on failure
+    void *(*malloc)(size_t size);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*free)(void *ptr);
+    size_t (*heap_size)(void);      // bytes obtained from system, denominator for utilization
+    bool (*validate)(void);         // heap consistency check (NULL if none)
+    bool (*validate_slice)(size_t); // incremental consistency check (NULL if none)
+    void (*stats)(heapstats_t *);   // free storage breakdown for timeline (NULL if none)
+    bool (*contains)(void *, size_t); // block lies in the backend's segments (NULL if not checked)
+    bool resets;                    // init discards all blocks, else leftovers must be freed first
+} backend_t;
+
+// libc's heap also holds the tester's own data (e.g. the parsed script), so
+// the bytes in use are sampled by init, just before each run, and left out of
+// the heap size. Free space libc kept from earlier runs still counts, as the
+// script's requests can be placed there.
+static size_t libc_baseline;
+static bool libc_init(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    libc_baseline = info.uordblks + info.hblkhd;
+    return true;
+}
+
+// For backends that use only the default heap segment
+static bool in_heap_segment(void *ptr, size_t size)
+{
+    return (char *)ptr >= (char *)heap_segment_start() &&
+           (char *)ptr + size <= (char *)heap_segment_start() + heap_segment_size();
+}
+static size_t libc_heap_size(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.arena + info.hblkhd - libc_baseline;  // main arena plus mmap'ed chunks
+}
+
+static const backend_t backends[] = {
+    {"custom", myinit, mymalloc, myrealloc, myfree, heap_total_size, validate_heap, validate_heap_slice, heap_stats, heap_contains, true},
+    {"libc", libc_init, malloc, realloc, free, libc_heap_size, NULL, NULL, NULL, NULL, false},
+    {"bump", bump_init, bump_malloc, bump_realloc, bump_free, heap_segment_size, NULL, NULL, NULL, in_heap_segment, true},
+    {"fixed", myinit, mymalloc_fixed, myrealloc, myfree_fixed, heap_total_size, validate_heap, validate_heap_slice, heap_stats, heap_contains, true},
+    {"threads", th_init, th_malloc, th_realloc, th_free, heap_segment_size, NULL, NULL, NULL, in_heap_segment, true},
+};
+static const backend_t *alloc = &backends[0];   // backend currently under test
+static size_t slice_budget;     // blocks per incremental heap check, 0 for full check
+
+// Settings from the command line that direct a run
+typedef struct {
+    flags_t which;              // which evaluations to run
+    const char *timeline_path;  // write heap timeline samples here (NULL if none)
+    const char *results_path;   // write JSON results here (NULL if none)
+} options_t;
 
 static void get_scripts(char *path, char files[][PATH_MAX], int max, int *pcount);
 static void parse_script(char *filename, script_t *script);
-static void run_scripts(char paths[][PATH_MAX], int n, flags_t flags);
+static void run_scripts(char paths[][PATH_MAX], int n, options_t *opts);
+static void eval_script(char *path, result_t *result, options_t *opts, FILE *timeline, uint64_t overhead, bool *first_sample);
+static void release_blocks(script_t *script);
+static void compare_backends(char paths[][PATH_MAX], int n, const backend_t *which[], int nbackends, options_t *opts);
+static const backend_t *find_backend(const char *name);
 static bool eval_correctness(script_t *script);
+static bool check_heap(void);
 static void eval_performance(void *data);
+static double eval_utilization(script_t *script);
+static void eval_latency(script_t *script, histogram_t hist[], uint64_t overhead);
+static uint64_t timer_overhead(void);
+static bool eval_timeline(script_t *script, FILE *fp, bool json, bool first);
 static bool verify_block(void *ptr, size_t size, script_t *script, int lineno);
+static void shadow_add(script_t *script, int id);
+static int cmp_range(const void *one, const void *two);
+static void shadow_nofree(void *node);
+static void shadow_remove(script_t *script, int id);
 static bool verify_payload(void *ptr, size_t size, int id, script_t *script, int lineno, char *op);
 static void print_table(result_t result[], int n, flags_t which);
+static void print_latency(result_t result[], int n, uint64_t overhead);
+static void record_counters(result_t *result);
+static void print_counters(result_t result[], int n);
+static void write_results(const char *path, result_t result[], int n);
+static int compare_results(char *before_paths[], int nbefore, char *after_paths[], int nafter);
 static void usage();
 static void fatal_error(char *format, ...);
 static void allocator_error(script_t *script, int lineno, char* format, ...);
@@ -101,32 +220,81 @@ static char *endswith(char *str, const char *suffix);
 int main(int argc, char *argv[])
 {
     char paths[MAX_SCRIPTS][PATH_MAX];
-    flags_t flags = Correctness | Performance; // default is to test both
+    options_t opts = {.which = Correctness | Performance}; // default is to test both
     char c;
     int nscripts = 0;
+    bool latency = false;
+    char *baseline_paths[MAX_RUNS];
+    int nbaselines = 0;
+    char *timer = NULL;
+    const backend_t *chosen[MAX_BACKENDS];
+    int nchosen = 0;
 
     CALLGRIND_TOGGLE_COLLECT ;// turn off profiling while we do the setup work, later turn on during simulation
-    while ((c = getopt(argc, argv, "f:pc")) != EOF) {
+    while ((c = getopt(argc, argv, "f:pclt:o:C:T:a:i:")) != EOF) {
         switch (c) {
             case 'f':
                 get_scripts(optarg, paths, sizeof(paths)/sizeof(paths[0]), &nscripts);
                 break;
             case 'p':
-                flags = Performance;
+                opts.which = Performance;
                 break;
             case 'c':
-                flags = Correctness;
+                opts.which = Correctness;
+                break;
+            case 'l':
+                latency = true;
+                break;
+            case 't':
+                opts.timeline_path = optarg;
+                break;
+            case 'o':
+                opts.results_path = optarg;
+                break;
+            case 'C':
+                for (char *path = strtok(optarg, ","); path && nbaselines < MAX_RUNS; path = strtok(NULL, ","))
+                    baseline_paths[nbaselines++] = path;
+                break;
+            case 'T':
+                timer = optarg;
+                break;
+            case 'i':
+                if ((slice_budget = strtoul(optarg, NULL, 10)) == 0) usage();
+                break;
+            case 'a':
+                for (char *name = strtok(optarg, ","); name && nchosen < MAX_BACKENDS; name = strtok(NULL, ","))
+                    chosen[nchosen++] = find_backend(name);
                 break;
             default:
                 usage();
         }
     }
+    if (nbaselines) { // compare mode, needs one or more results files to compare against baseline
+        if (optind == argc || argc - optind > MAX_RUNS) usage();
+        return compare_results(baseline_paths, nbaselines, argv + optind, argc - optind);
+    }
     if (optind < argc) usage();
+    if (latency) opts.which |= Latency;
+    if (timer) {
+        fcyc_timer_t which;
+        for (which = TIMER_TSC; which <= TIMER_PERF; which++)
+            if (strcmp(timer, fcyc_timer_name(which)) == 0) break;
+        if (which > TIMER_PERF) usage();
+        if (!fcyc_set_timer(which))
+            fatal_error("Timer \"%s\" is not available on this machine.\n", timer);
+    }
     if (nscripts == 0)
-        get_scripts(DEFAULT_SCRIPT_DIR, paths, sizeof(paths)/sizeof(paths[0]), &nscripts);
+        get_scripts(access(DEFAULT_SCRIPT_DIR, R_OK) == 0 ? DEFAULT_SCRIPT_DIR : LOCAL_SCRIPT_DIR,
+                    paths, sizeof(paths)/sizeof(paths[0]), &nscripts);
     qsort(paths, nscripts, sizeof(paths[0]), cmpbase); // sort by filename
     setvbuf(stdout, NULL, _IONBF, 0); // disable stdout buffering, all printfs display to terminal immediately
-    run_scripts(paths, nscripts, flags);
+    if (nchosen > 1) { // side-by-side table only, no per-backend latency, timeline or results file
+        if (latency || opts.timeline_path || opts.results_path) usage();
+        compare_backends(paths, nscripts, chosen, nchosen, &opts);
+        return 0;
+    }
+    if (nchosen == 1) alloc = chosen[0];
+    run_scripts(paths, nscripts, &opts);
     return 0;
 }
 
@@ -166,31 +334,186 @@ static void get_scripts(char *path, char files[][PATH_MAX], int max, int *pcount
  * Runs a set of scripts against the allocator.  It loops script-by-script.
  * For each script, runs once for correctness (unless flags are perf only)
  * and if had no correctness errors, runs a performance trial on the same script.
- * Records results into an array, which is printed at end.
+ * If latency was requested, one further run records the latency of
+ * each individual request into per-op histograms. If a timeline path is given,
+ * the heap state sampled over each script is written to that file (JSON if
+ * the name ends in .json, otherwise CSV).
+ * Records results into an array, which is printed at end (and written as JSON
+ * if a results path is given).
  */
-static void run_scripts(char paths[][PATH_MAX], int n, flags_t which)
+static void run_scripts(char paths[][PATH_MAX], int n, options_t *opts)
 {
     result_t result[n];
+    flags_t which = opts->which;
+    uint64_t overhead = (which & Latency) ? timer_overhead() : 0;
+    FILE *timeline = NULL;
+    bool json = opts->timeline_path && endswith((char *)opts->timeline_path, ".json");
+    bool first_sample = true;
+
+    if (opts->timeline_path && (timeline = fopen(opts->timeline_path, "w")) == NULL)
+        fatal_error("Could not open timeline file \"%s\".\n", opts->timeline_path);
+
+    for (int i = 0; i < n; i++)
+        eval_script(paths[i], &result[i], opts, timeline, overhead, &first_sample);
+    if (timeline) {
+        fprintf(timeline, json ? "%s]\n" : "", first_sample ? "[" : "\n");
+        fclose(timeline);
+    }
+    print_table(result, n, which); // display results
+    print_counters(result, n);
+    if (opts->results_path)
+        write_results(opts->results_path, result, n);
+    if (which & Latency) {
+        print_latency(result, n, overhead);
+        for (int i = 0; i < n; i++)
+            free(result[i].latency);
+    }
+}
+
+
+/* Function: eval_script
+ * ----------------------
+ * Runs the evaluations selected in opts on a single script against the
+ * backend under test, storing outcome into result. Timeline samples are
+ * written to the timeline file (if non-NULL), the first_sample flag tracks
+ * whether any sample has been written to it yet.
+ */
+static void eval_script(char *path, result_t *result, options_t *opts, FILE *timeline, uint64_t overhead, bool *first_sample)
+{
+    flags_t which = opts->which;
+    bool json = opts->timeline_path && endswith((char *)opts->timeline_path, ".json");
+    script_t script;
+
+    parse_script(path, &script);
+    strcpy(result->name, script.name);
+    result->num_ops = script.num_ops;
+    printf("Evaluating allocator on %s....", script.name);
+    result->valid = !(which & Correctness) || eval_correctness(&script);
+    if (result->valid && (which & Performance)) {
+        result->secs = fsecs(eval_performance, &script);
+        result->tput = result->num_ops/(result->secs*1e3);
+        fsecs_samples(&result->nsamples, &result->secs_mean, &result->secs_stddev);
+        record_counters(result);
+        result->utilization = eval_utilization(&script);
+    } else {
+        result->secs = result->utilization = 0;
+        result->nsamples = result->secs_mean = result->secs_stddev = 0;
+        result->has_counters = false;
+    }
+    result->latency = NULL;
+    if (result->valid && (which & Latency)) {
+        result->latency = calloc(NUM_OPS, sizeof(histogram_t));
+        if (!result->latency)
+            fatal_error("Libc heap exhausted. Cannot continue.\n");
+        eval_latency(&script, result->latency, overhead);
+    }
+    if (result->valid && timeline)
+        *first_sample = eval_timeline(&script, timeline, json, *first_sample);
+    printf("done.\n");
+    release_blocks(&script);
+    tdestroy(script.shadow, shadow_nofree);
+    free(script.ops);
+    free(script.blocks);
+}
+
+
+/* Function: compare_backends
+ * ---------------------------
+ * Replays every script against each of the chosen backends and prints the
+ * results side by side. Each (script, backend) run happens in its own forked
+ * child, which gives every backend a fresh process heap and lets the parent
+ * read the child's peak resident set size from wait4. The child stores its
+ * result into memory shared with the parent. A backend that crashes on a
+ * script is reported as not correct rather than taking down the comparison.
+ */
+static void compare_backends(char paths[][PATH_MAX], int n, const backend_t *which[], int nbackends, options_t *opts)
+{
+    result_t *shared = mmap(NULL, n*nbackends*sizeof(result_t), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        fatal_error("Could not map shared memory for results.\n");
+    options_t child_opts = {.which = opts->which & (Correctness | Performance)};
+
+    fcyc_ticks_per_sec(); // calibrate timer once, before forking
+    for (int b = 0; b < nbackends; b++) {
+        printf("Using backend %s:\n", which[b]->name);
+        for (int i = 0; i < n; i++) {
+            result_t *res = &shared[b*n + i];
+            strcpy(res->name, mybasename(paths[i]));
+            res->valid = false;
+            pid_t pid = fork();
+            if (pid == 0) {
+                alloc = which[b];
+                eval_script(paths[i], res, &child_opts, NULL, 0, NULL);
+                _exit(0);
+            }
+            int status;
+            struct rusage usage;
+            if (pid < 0 || wait4(pid, &status, 0, &usage) < 0)
+                fatal_error("Could not run child process for %s.\n", which[b]->name);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                printf("\n%s crashed on %s.\n", which[b]->name, paths[i]);
+                res->valid = false;
+            }
+            res->peak_rss_kb = usage.ru_maxrss;
+        }
+    }
 
+    char *dashes = "-------------------------------------------------------------------------------";
+    printf("\n script name          backend  correct?  utilization     Kreq/sec   peak RSS (MB)\n%s\n", dashes);
     for (int i = 0; i < n; i++) {
-        script_t script;
-        parse_script(paths[i], &script);
-        strcpy(result[i].name, script.name);
-        result[i].num_ops = script.num_ops;
-        printf("Evaluating allocator on %s....", script.name);
-        result[i].valid = !(which & Correctness) || eval_correctness(&script);
-        if (result[i].valid && (which & Performance)) {
-            perfdata_t pd = {.script = &script, .utilization = &result[i].utilization};
-            result[i].secs = fsecs(eval_performance, &pd);
-            result[i].tput = result[i].num_ops/(result[i].secs*1e3);
-        } else {
-            result[i].secs = result[i].utilization = 0;
+        for (int b = 0; b < nbackends; b++) {
+            result_t *res = &shared[b*n + i];
+            printf("%-20s %-9s %-7s ", b == 0 ? res->name : "", which[b]->name,
+                   (opts->which & Correctness) ? (res->valid ? "Y" : "N") : "");
+            if (res->valid && (opts->which & Performance))
+                printf("%10.0f%% %12d %15.1f\n", res->utilization*100, res->tput, res->peak_rss_kb/1024.0);
+            else
+                printf("%11s %12s %15s\n", "-", "-", "-");
         }
-        printf("done.\n");
-        free(script.ops);
-        free(script.blocks);
     }
-    print_table(result, n, which); // display results
+    printf("%s\n\n", dashes);
+    munmap(shared, n*nbackends*sizeof(result_t));
+}
+
+
+/* Function: find_backend
+ * ----------------------
+ * Looks up backend by name, raises fatal error if no such backend.
+ */
+static const backend_t *find_backend(const char *name)
+{
+    for (int i = 0; i < sizeof(backends)/sizeof(backends[0]); i++)
+        if (strcmp(name, backends[i].name) == 0) return &backends[i];
+    fatal_error("No allocator backend named \"%s\".\n", name);
+    return NULL;
+}
+
+
+/* Function: release_blocks
+ * ------------------------
+ * Frees any blocks the script left allocated, for backends whose init
+ * does not discard the heap (i.e. libc). Does nothing for the others.
+ */
+static void release_blocks(script_t *script)
+{
+    if (alloc->resets) return;
+    for (int id = 0; id < script->num_ids; id++)
+        if (script->blocks[id].ptr) alloc->free(script->blocks[id].ptr);
+    memset(script->blocks, 0, script->num_ids*sizeof(script->blocks[0]));
+}
+
+
+/* Function: reset_heap
+ * --------------------
+ * Readies the backend for a fresh run of the script. Blocks left over from
+ * the previous run are released first. Returns the result of the backend's init.
+ */
+static bool reset_heap(script_t *script)
+{
+    release_blocks(script);
+    bool ok = alloc->init();
+    memset(script->blocks, 0, script->num_ids*sizeof(script->blocks[0]));
+    return ok;
 }
 
 
@@ -261,6 +584,7 @@ static void parse_script(char *path, script_t *script)
     script->blocks = calloc(script->num_ids, sizeof(block_t));
     if (!script->blocks)
         fatal_error("Libc heap exhausted. Cannot continue.\n");
+    script->shadow = NULL;
 }
 
 
@@ -272,15 +596,16 @@ static void parse_script(char *path, script_t *script)
  */
 static bool eval_correctness(script_t *script)
 {
-    if (!myinit()) {
-        allocator_error(script, 0, "myinit() returned false");
+    if (!reset_heap(script)) {
+        allocator_error(script, 0, "%s init returned false", alloc->name);
         return false;
     }
-    if (!validate_heap()) { // check heap consistency after init
+    if (!check_heap()) { // check heap consistency after init
         allocator_error(script, 0, "validate_heap() returned false, called after myinit");
         return false;
     }
-    memset(script->blocks, 0, script->num_ids*sizeof(script->blocks[0]));
+    tdestroy(script->shadow, shadow_nofree); // start with empty shadow heap
+    script->shadow = NULL;
 
     for (int req = 0; req < script->num_ops; req++) {
         int id = script->ops[req].id;
@@ -291,7 +616,7 @@ static bool eval_correctness(script_t *script)
         switch (script->ops[req].op) {
 
             case ALLOC:
-                if ((p = mymalloc(requested_size)) == NULL && requested_size != 0) {
+                if ((p = alloc->malloc(requested_size)) == NULL && requested_size != 0) {
                     allocator_error(script, script->ops[req].lineno, "malloc returned NULL");
                     return false;
                 }
@@ -304,17 +629,19 @@ static bool eval_correctness(script_t *script)
                 // can be used later to verify data copied when realloc'ing
                 memset(p, id & 0xFF, requested_size);
                 script->blocks[id] = (block_t){.ptr = p, .size = requested_size};
+                shadow_add(script, id);
                 break;
 
             case REALLOC:
                 if (!verify_payload(oldp, old_size, id, script, script->ops[req].lineno, "realloc-ing"))
                     return false;
-                if ((newp = myrealloc(oldp, requested_size)) == NULL && requested_size != 0) {
+                if ((newp = alloc->realloc(oldp, requested_size)) == NULL && requested_size != 0) {
                     allocator_error(script, script->ops[req].lineno, "realloc returned NULL");
                     return false;
                 }
 
                 old_size = script->blocks[id].size;
+                shadow_remove(script, id);
                 script->blocks[id].size = 0;
                 if (!verify_block(newp, requested_size, script, script->ops[req].lineno))
                     return false;
@@ -328,6 +655,7 @@ static bool eval_correctness(script_t *script)
                 // Fill new block with the low-order byte of new id
                 memset(newp, id & 0xFF, requested_size);
                 script->blocks[id] = (block_t){.ptr = newp, .size = requested_size};
+                shadow_add(script, id);
                 break;
 
             case FREE:
@@ -336,12 +664,13 @@ static bool eval_correctness(script_t *script)
                 // verify payload intact before free
                 if (!verify_payload(p, old_size, id, script, script->ops[req].lineno, "freeing"))
                     return false;
+                shadow_remove(script, id);
                 script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
-                myfree(p);
+                alloc->free(p);
                 break;
         }
 
-        if (!validate_heap()) { // check heap consistency after each request
+        if (!check_heap()) { // check heap consistency after each request
             allocator_error(script, script->ops[req].lineno, "validate_heap() returned false, called in-between requests");
             return false;   // stop at first sign of error
         }
@@ -355,24 +684,34 @@ static bool eval_correctness(script_t *script)
 }
 
 
+/* Function: check_heap
+ * ---------------------
+ * Runs the backend's heap consistency check, if it has one. With the -i
+ * option, the incremental check is used instead so each request only pays
+ * for a bounded slice of the heap.
+ */
+static bool check_heap(void)
+{
+    if (slice_budget && alloc->validate_slice)
+        return alloc->validate_slice(slice_budget);
+    return !alloc->validate || alloc->validate();
+}
+
 /* Function: eval_performance
  * --------------------------
  * This is almost same code as function above, but unifying the two clutters
  * the code path adds performance penalties to the time trial, which needed to
  * be avoided. This interprets the script with no additional overhead
- * (e.g. no checking for validity), measures time, and tracks the high water mark
- * of the heap segment to report on memory utilization.  The function
- * takes a void* client pointer, since that is what is required to work
- * with the timing trial code. This client data provides the script to exeucute.
+ * (e.g. no checking for validity) so that only the backend's malloc, realloc
+ * and free are measured. The function takes a void* client pointer, since
+ * that is what is required to work with the timing trial code. This client
+ * data is the script to execute.
  */
 static void eval_performance(void *data)
 {
-    perfdata_t *pd = (perfdata_t *)data;
-    size_t peak_payload_size = 0, cur_payload_size = 0, max_segment_size = 0;
-    script_t *script = pd->script;
+    script_t *script = (script_t *)data;
 
-    myinit();
-    memset(script->blocks, 0, script->num_ids*sizeof(script->blocks[0]));
+    reset_heap(script);
 
     CALLGRIND_TOGGLE_COLLECT;	// turn on valgrind profiler here
     for (int line = 0; line < script->num_ops;  line++) {
@@ -382,38 +721,265 @@ static void eval_performance(void *data)
         switch (script->ops[line].op) {
 
             case ALLOC:
-                script->blocks[id].ptr = mymalloc(requested_size);
+                script->blocks[id].ptr = alloc->malloc(requested_size);
                 script->blocks[id].size = requested_size;
-                cur_payload_size += requested_size;
                 if (requested_size) ((char *)script->blocks[id].ptr)[0] = ((char *)script->blocks[id].ptr)[requested_size-1] = 0xab;
                 break;
 
             case REALLOC:
-                script->blocks[id].ptr = myrealloc(script->blocks[id].ptr, requested_size);
-                cur_payload_size += (requested_size - script->blocks[id].size);
+                script->blocks[id].ptr = alloc->realloc(script->blocks[id].ptr, requested_size);
                 script->blocks[id].size = requested_size;
                 if (requested_size) ((char *)script->blocks[id].ptr)[0] = ((char *)script->blocks[id].ptr)[requested_size-1] = 0xcd;
                 break;
 
             case FREE:
-                myfree(script->blocks[id].ptr);
+                alloc->free(script->blocks[id].ptr);
+                script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
+                break;
+        }
+     }
+    CALLGRIND_TOGGLE_COLLECT;  // turn off profiler here
+}
+
+
+/* Function: eval_utilization
+ * --------------------------
+ * Replays the script once more, outside of the time trial, tracking the high
+ * water mark of the heap to report on memory utilization. Asking the backend
+ * for its heap size after every request can be costly (libc has to walk its
+ * arenas), which is why this is kept out of eval_performance. Returns the
+ * peak ratio of payload in use to heap size.
+ */
+static double eval_utilization(script_t *script)
+{
+    size_t peak_payload_size = 0, cur_payload_size = 0, max_segment_size = 0;
+
+    reset_heap(script);
+    for (int line = 0; line < script->num_ops;  line++) {
+        int id = script->ops[line].id;
+        size_t requested_size = script->ops[line].size;
+
+        switch (script->ops[line].op) {
+
+            case ALLOC:
+                script->blocks[id].ptr = alloc->malloc(requested_size);
+                script->blocks[id].size = requested_size;
+                cur_payload_size += requested_size;
+                break;
+
+            case REALLOC:
+                script->blocks[id].ptr = alloc->realloc(script->blocks[id].ptr, requested_size);
+                cur_payload_size += (requested_size - script->blocks[id].size);
+                script->blocks[id].size = requested_size;
+                break;
+
+            case FREE:
+                alloc->free(script->blocks[id].ptr);
                 cur_payload_size -= script->blocks[id].size;
                 script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
                 break;
         }
 
         // peak util is ratio of inuse/segment, reset when either changes (numerator or denom)
-        if (heap_segment_size() > max_segment_size || (cur_payload_size > peak_payload_size) ) {
-            max_segment_size = heap_segment_size();
+        size_t segment_size = alloc->heap_size();
+        if (segment_size > max_segment_size || (cur_payload_size > peak_payload_size) ) {
+            max_segment_size = segment_size;
             peak_payload_size = cur_payload_size;
-        } 
-     }
- 
-    *pd->utilization = ((double)peak_payload_size)/max_segment_size;
-    CALLGRIND_TOGGLE_COLLECT;  // turn off profiler here
+        }
+    }
+    return ((double)peak_payload_size)/max_segment_size;
+}
+
+
+/* Function: timer_overhead
+ * ------------------------
+ * Estimates the cost of the timestamping itself as the cheapest of many
+ * back-to-back timer reads. This is subtracted from every latency sample,
+ * using the minimum means a sample is never over-corrected.
+ */
+static uint64_t timer_overhead(void)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = fcyc_now();
+        uint64_t elapsed = fcyc_now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// Maps a value to its log-linear bucket. Values below HIST_SUB_COUNT get an
+// exact bucket each, above that the top HIST_SUB_BITS+1 bits select the bucket.
+static int hist_index(uint64_t val)
+{
+    if (val < HIST_SUB_COUNT) return val;
+    int shift = (63 - __builtin_clzll(val)) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + ((val >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+// Inverse of hist_index, returns the highest value that maps to bucket index
+static uint64_t hist_value(int index)
+{
+    if (index < HIST_SUB_COUNT) return index;
+    int shift = index / HIST_SUB_COUNT - 1;
+    uint64_t low = (uint64_t)(HIST_SUB_COUNT + index % HIST_SUB_COUNT) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+static void hist_record(histogram_t *h, uint64_t val)
+{
+    h->counts[hist_index(val)]++;
+    h->total++;
+    if (val > h->max) h->max = val;
+}
+
+// Returns value at given percentile, never reports more than the exact max
+static uint64_t hist_percentile(const histogram_t *h, double pct)
+{
+    uint64_t rank = (uint64_t)ceil(pct/100 * h->total), seen = 0;
+    if (rank == 0) rank = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+
+/* Function: eval_latency
+ * ----------------------
+ * Interprets the script once more, this time timestamping each individual
+ * request with the fcyc timer and recording the elapsed ticks (less the
+ * timer overhead) into the histogram for that request type. Aggregate
+ * throughput hides the occasional expensive request (e.g. exhaustive search
+ * of the free lists or a call to extend the heap segment), the histogram
+ * tail shows it.
+ */
+static void eval_latency(script_t *script, histogram_t hist[], uint64_t overhead)
+{
+    reset_heap(script);
+
+    for (int line = 0; line < script->num_ops;  line++) {
+        int id = script->ops[line].id;
+        size_t requested_size = script->ops[line].size;
+        uint64_t start, elapsed = 0;
+
+        switch (script->ops[line].op) {
+
+            case ALLOC:
+                start = fcyc_now();
+                script->blocks[id].ptr = alloc->malloc(requested_size);
+                elapsed = fcyc_now() - start;
+                script->blocks[id].size = requested_size;
+                if (requested_size) ((char *)script->blocks[id].ptr)[0] = ((char *)script->blocks[id].ptr)[requested_size-1] = 0xab;
+                break;
+
+            case REALLOC:
+                start = fcyc_now();
+                script->blocks[id].ptr = alloc->realloc(script->blocks[id].ptr, requested_size);
+                elapsed = fcyc_now() - start;
+                script->blocks[id].size = requested_size;
+                if (requested_size) ((char *)script->blocks[id].ptr)[0] = ((char *)script->blocks[id].ptr)[requested_size-1] = 0xcd;
+                break;
+
+            case FREE:
+                start = fcyc_now();
+                alloc->free(script->blocks[id].ptr);
+                elapsed = fcyc_now() - start;
+                script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
+                break;
+        }
+        hist_record(&hist[script->ops[line].op - 1], elapsed > overhead ? elapsed - overhead : 0);
+    }
+}
+
+
+/* Function: write_sample
+ * ----------------------
+ * Writes one timeline sample as a CSV row or JSON object. External
+ * fragmentation is the fraction of free bytes outside the largest free block,
+ * i.e. how much free storage could not serve a single request of that size.
+ */
+static void write_sample(FILE *fp, bool json, bool first, const char *name, int line,
+                         size_t payload, size_t segment, heapstats_t *stats)
+{
+    double frag = stats->free_bytes ? 1 - (double)stats->largest_free/stats->free_bytes : 0;
+
+    if (json) {
+        fprintf(fp, "%s\n  {\"script\": \"%s\", \"op\": %d, \"payload\": %zu, \"segment\": %zu, "
+                "\"free\": %zu, \"largest_free\": %zu, \"ext_frag\": %.4f, \"class_free\": [",
+                first ? "[" : ",", name, line, payload, segment, stats->free_bytes, stats->largest_free, frag);
+        for (int i = 0; i < stats->nclasses; i++)
+            fprintf(fp, "%s%zu", i ? ", " : "", stats->class_free[i]);
+        fprintf(fp, "]}");
+    } else {
+        if (first) {
+            fprintf(fp, "script,op,payload,segment,free,largest_free,ext_frag");
+            for (int i = 0; i < HEAP_STATS_CLASSES; i++)
+                fprintf(fp, ",class%d_free", i);
+            fprintf(fp, "\n");
+        }
+        fprintf(fp, "%s,%d,%zu,%zu,%zu,%zu,%.4f", name, line, payload, segment,
+                stats->free_bytes, stats->largest_free, frag);
+        for (int i = 0; i < HEAP_STATS_CLASSES; i++)
+            fprintf(fp, ",%zu", i < stats->nclasses ? stats->class_free[i] : 0);
+        fprintf(fp, "\n");
+    }
 }
 
 
+/* Function: eval_timeline
+ * -----------------------
+ * Interprets the script (untimed) and samples the heap at TIMELINE_SAMPLES
+ * evenly spaced points in the request sequence, plus after the final request.
+ * Each sample records in-use payload, segment size and the free storage
+ * breakdown from heap_stats, so a plot shows when and why the heap bloats
+ * rather than just the peak utilization percentage. The first flag says whether
+ * no sample has yet been written to the file, its updated value is returned.
+ */
+static bool eval_timeline(script_t *script, FILE *fp, bool json, bool first)
+{
+    size_t cur_payload_size = 0;
+    int interval = script->num_ops/TIMELINE_SAMPLES > 0 ? script->num_ops/TIMELINE_SAMPLES : 1;
+    heapstats_t stats;
+
+    reset_heap(script);
+
+    for (int line = 0; line < script->num_ops;  line++) {
+        int id = script->ops[line].id;
+        size_t requested_size = script->ops[line].size;
+
+        switch (script->ops[line].op) {
+
+            case ALLOC:
+                script->blocks[id].ptr = alloc->malloc(requested_size);
+                script->blocks[id].size = requested_size;
+                cur_payload_size += requested_size;
+                break;
+
+            case REALLOC:
+                script->blocks[id].ptr = alloc->realloc(script->blocks[id].ptr, requested_size);
+                cur_payload_size += (requested_size - script->blocks[id].size);
+                script->blocks[id].size = requested_size;
+                break;
+
+            case FREE:
+                alloc->free(script->blocks[id].ptr);
+                cur_payload_size -= script->blocks[id].size;
+                script->blocks[id] = (block_t){.ptr = NULL, .size = 0};
+                break;
+        }
+        if ((line + 1) % interval == 0 || line == script->num_ops - 1) {
+            memset(&stats, 0, sizeof(stats));
+            if (alloc->stats) alloc->stats(&stats);
+            write_sample(fp, json, first, script->name, line + 1, cur_payload_size, alloc->heap_size(), &stats);
+            first = false;
+        }
+    }
+    return first;
+}
+
 
 /* Function: verify_block
  * ----------------------
@@ -436,27 +1002,66 @@ static bool verify_block(void *ptr, size_t size, script_t *script, int lineno)
 
     // block must lie within the extent of the heap
     void *end = (char *)ptr + size;
-    void *heap_end = (char *)heap_segment_start() + heap_segment_size();
-    if (ptr < heap_segment_start() || end > heap_end) {
-        allocator_error(script, lineno, "New block (%p:%p) not within heap segment (%p:%p)",
-                        ptr, end, heap_segment_start(), heap_end);
+    if (alloc->contains && !alloc->contains(ptr, size)) {
+        allocator_error(script, lineno, "New block (%p:%p) not within heap segments", ptr, end);
         return false;
     }
-    // block must not overlap any other blocks
-    for (int i = 0; i < script->num_ids; i++) {
-        if (script->blocks[i].ptr == NULL || script->blocks[i].size == 0) continue;
-        void *other_start = script->blocks[i].ptr;
-        void *other_end = (char *)other_start + script->blocks[i].size;
-        if ((ptr >= other_start && ptr < other_end) || (end > other_start && end < other_end) ||
-            (ptr < other_start && end >= other_end)){
-            allocator_error(script, lineno, "New block (%p:%p) overlaps existing block (%p:%p)",
-                            ptr, end, other_start, other_end);
-            return false;
-        }
+    // block must not overlap any other blocks, shadow tree finds a match
+    // in O(log n) as any overlapping range compares equal
+    block_t key = {.ptr = ptr, .size = size};
+    block_t **found = tfind(&key, &script->shadow, cmp_range);
+    if (found) {
+        void *other_start = (*found)->ptr;
+        void *other_end = (char *)other_start + (*found)->size;
+        allocator_error(script, lineno, "New block (%p:%p) overlaps existing block (%p:%p)",
+                        ptr, end, other_start, other_end);
+        return false;
     }
     return true;
 }
 
+/* Function: cmp_range
+ * -------------------
+ * Comparator for the shadow heap, orders blocks by address range. Two
+ * blocks that overlap compare as equal, which is what lets tfind report a
+ * collision directly. A zero-size block is treated as occupying one byte
+ * so that it still collides with any block containing its address.
+ */
+static int cmp_range(const void *one, const void *two)
+{
+    const block_t *a = one, *b = two;
+    char *a_end = (char *)a->ptr + (a->size ? a->size : 1);
+    char *b_end = (char *)b->ptr + (b->size ? b->size : 1);
+    if (a_end <= (char *)b->ptr) return -1;
+    if (b_end <= (char *)a->ptr) return 1;
+    return 0;
+}
+
+/* Function: shadow_add, shadow_remove
+ * -----------------------------------
+ * Keep the shadow heap in step with script->blocks. The tree stores pointers
+ * into the blocks array, so an entry must be removed before its block_t is
+ * changed. Zero-size blocks are never added, matching the old linear scan
+ * which ignored them as existing blocks.
+ */
+static void shadow_add(script_t *script, int id)
+{
+    if (script->blocks[id].ptr == NULL || script->blocks[id].size == 0) return;
+    if (tsearch(&script->blocks[id], &script->shadow, cmp_range) == NULL)
+        fatal_error("Libc heap exhausted. Cannot continue.\n");
+}
+
+static void shadow_remove(script_t *script, int id)
+{
+    if (script->blocks[id].ptr == NULL || script->blocks[id].size == 0) return;
+    tdelete(&script->blocks[id], &script->shadow, cmp_range);
+}
+
+// tree nodes point into script->blocks, nothing to free when tearing down
+static void shadow_nofree(void *node)
+{
+}
+
 
 /* Function: verify_payload
  * ------------------------
@@ -530,6 +1135,249 @@ static void print_table(result_t result[], int n, flags_t which)
     printf("\n");
 }
 
+/* Function: print_latency
+ * ------------------------
+ * Prints table of per-request latency percentiles, one row for each request
+ * type used in each script.
+ */
+static void print_latency(result_t result[], int n, uint64_t overhead)
+{
+    char *dashes = "-------------------------------------------------------------------------------";
+    const char *opnames[NUM_OPS] = {"malloc", "free", "realloc"};
+
+    printf(" script name     op            count        p50        p99      p99.9        max\n%s\n", dashes);
+    for (int i = 0; i < n; i++) {
+        if (!result[i].latency) continue;
+        for (int op = 0; op < NUM_OPS; op++) {
+            histogram_t *h = &result[i].latency[op];
+            if (h->total == 0) continue;
+            printf("%-15s %-8s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n", result[i].name, opnames[op], h->total,
+                   hist_percentile(h, 50), hist_percentile(h, 99), hist_percentile(h, 99.9), h->max);
+        }
+    }
+    printf("%s\n", dashes);
+    const char *unit = fcyc_get_timer() == TIMER_TSC ? "cycles" : "ns";
+    printf("\tLatencies in %s, timer overhead of %" PRIu64 " %s subtracted from each request.\n\n", unit, overhead, unit);
+}
+
+/* Function: write_results
+ * ------------------------
+ * Writes results as JSON, along with a description of the host the results
+ * were measured on. Each script result is written on a single line, which
+ * lets compare_results read it back without needing a full JSON parser.
+ */
+static void write_results(const char *path, result_t result[], int n)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        fatal_error("Could not open results file \"%s\".\n", path);
+
+    struct utsname host;
+    char line[1024], cpu[256] = "unknown";
+    FILE *info = fopen("/proc/cpuinfo", "r");
+    while (info && fgets(line, sizeof(line), info)) {
+        if (strncmp(line, "model name", strlen("model name")) == 0) {
+            char *val = strchr(line, ':');
+            if (val) sscanf(val + 1, " %255[^\n\"]", cpu);
+            break;
+        }
+    }
+    if (info) fclose(info);
+    uname(&host);
+
+    fprintf(fp, "{\n  \"host\": {\"hostname\": \"%s\", \"kernel\": \"%s %s\", \"machine\": \"%s\", "
+            "\"cpu\": \"%s\", \"cpus\": %ld, \"mhz\": %.1f, \"timer\": \"%s\"},\n  \"scripts\": [",
+            host.nodename, host.sysname, host.release, host.machine, cpu,
+            sysconf(_SC_NPROCESSORS_ONLN), fcyc_mhz(), fcyc_timer_name(fcyc_get_timer()));
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"valid\": %s, \"ops\": %d, \"secs\": %.9f, "
+                "\"secs_mean\": %.9f, \"secs_stddev\": %.9f, \"samples\": %d, \"utilization\": %.6f, "
+                "\"kreq_per_sec\": %d", i ? "," : "", result[i].name, result[i].valid ? "true" : "false",
+                result[i].num_ops, result[i].secs, result[i].secs_mean, result[i].secs_stddev,
+                result[i].nsamples, result[i].utilization, result[i].tput);
+        if (result[i].has_counters)
+            fprintf(fp, ", \"ipc\": %.4f, \"cache_misses_per_req\": %.4f, \"dtlb_misses_per_req\": %.4f",
+                    result[i].ipc, result[i].cache_misses, result[i].dtlb_misses);
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+}
+
+
+// Scans the value for "key" out of a single-line JSON object, NULL if not present
+static const char *json_field(const char *line, const char *key)
+{
+    char pattern[64];
+    sprintf(pattern, "\"%s\": ", key);
+    const char *found = strstr(line, pattern);
+    return found ? found + strlen(pattern) : NULL;
+}
+
+static double json_number(const char *line, const char *key)
+{
+    const char *val = json_field(line, key);
+    return val ? atof(val) : 0;
+}
+
+
+/* Function: read_results
+ * ----------------------
+ * Reads back the script results from a file written by write_results.
+ * Returns number of results read, at most max.
+ */
+static int read_results(const char *path, result_t result[], int max)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        fatal_error("Could not open results file \"%s\".\n", path);
+
+    char line[2048];
+    int n = 0;
+    while (n < max && fgets(line, sizeof(line), fp)) {
+        const char *name = json_field(line, "name");
+        if (!name || sscanf(name, "\"%127[^\"]\"", result[n].name) != 1) continue;
+        const char *valid = json_field(line, "valid");
+        result[n].valid = valid && strncmp(valid, "true", 4) == 0;
+        result[n].num_ops = json_number(line, "ops");
+        result[n].secs = json_number(line, "secs");
+        result[n].secs_mean = json_number(line, "secs_mean");
+        result[n].secs_stddev = json_number(line, "secs_stddev");
+        result[n].nsamples = json_number(line, "samples");
+        result[n].utilization = json_number(line, "utilization");
+        result[n].tput = json_number(line, "kreq_per_sec");
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+
+// Summarizes the timing of the named script over the runs on one side of a
+// comparison: the mean run time, the variance of that mean and the mean
+// utilization. With several runs, each run's mean is one independent
+// observation. A single run falls back on its own samples, which are taken
+// back to back and so understate the variation between runs. Returns false
+// if the script is missing or has no valid timing in any run.
+static bool summarize_runs(result_t runs[][MAX_SCRIPTS], int counts[], int nruns, const char *name,
+                           double *mean, double *var, double *utilization, int *num_ops)
+{
+    double sum = 0, sumsq = 0, util = 0;
+    for (int r = 0; r < nruns; r++) {
+        result_t *found = NULL;
+        for (int j = 0; j < counts[r] && !found; j++)
+            if (strcmp(runs[r][j].name, name) == 0) found = &runs[r][j];
+        if (!found || !found->valid || found->secs_mean <= 0) return false;
+        sum += found->secs_mean;
+        sumsq += found->secs_mean*found->secs_mean;
+        util += found->utilization;
+        *num_ops = found->num_ops;
+        if (nruns == 1)
+            *var = found->nsamples ? found->secs_stddev*found->secs_stddev/found->nsamples : 0;
+    }
+    *mean = sum/nruns;
+    *utilization = util/nruns;
+    if (nruns > 1) {
+        double runvar = (sumsq - nruns*(*mean)*(*mean))/(nruns - 1);
+        *var = runvar > 0 ? runvar/nruns : 0;
+    }
+    return true;
+}
+
+
+/* Function: compare_results
+ * -------------------------
+ * Diffs two sets of results files script-by-script and prints the change in
+ * throughput and utilization. Each set holds one or more independent runs of
+ * the same build. Throughput is compared with Welch's t-test on the mean run
+ * time, so a change is only flagged as a regression when it is both larger
+ * than REGRESS_PCT and unlikely to be timing noise. The Kreq/sec columns are
+ * computed from the same mean run times as the change. Returns the exit
+ * status for the program: 0 if no regressions, 1 otherwise.
+ */
+static int compare_results(char *before_paths[], int nbefore, char *after_paths[], int nafter)
+{
+    static result_t before[MAX_RUNS][MAX_SCRIPTS], after[MAX_RUNS][MAX_SCRIPTS];
+    int before_counts[MAX_RUNS], after_counts[MAX_RUNS];
+    char *dashes = "-------------------------------------------------------------------------------";
+    int regressions = 0;
+    bool single = nbefore == 1 || nafter == 1;
+
+    for (int r = 0; r < nbefore; r++)
+        before_counts[r] = read_results(before_paths[r], before[r], MAX_SCRIPTS);
+    for (int r = 0; r < nafter; r++)
+        after_counts[r] = read_results(after_paths[r], after[r], MAX_SCRIPTS);
+
+    printf(" script name        Kreq/sec before   after  change      t     util before   after\n%s\n", dashes);
+    for (int i = 0; i < after_counts[0]; i++) {
+        const char *name = after[0][i].name;
+        double old_mean, old_var, old_util, cur_mean, cur_var, cur_util;
+        int num_ops;
+        if (!summarize_runs(after, after_counts, nafter, name, &cur_mean, &cur_var, &cur_util, &num_ops) ||
+            !summarize_runs(before, before_counts, nbefore, name, &old_mean, &old_var, &old_util, &num_ops)) {
+            printf("%-20s (not in every run, or no valid timing to compare)\n", name);
+            continue;
+        }
+
+        // positive change/t means after is faster than before
+        double change = (old_mean/cur_mean - 1)*100;
+        double stderr2 = old_var + cur_var;
+        double t = stderr2 > 0 ? (old_mean - cur_mean)/sqrt(stderr2) : (change > 0 ? INFINITY : -INFINITY);
+        bool slower = change < -REGRESS_PCT && t < -REGRESS_T && !(single && change > -REGRESS_NOISE);
+        bool lesscompact = cur_util < old_util - REGRESS_UTIL;
+
+        printf("%-20s %14.0f %7.0f %+6.1f%% %6.1f %10.0f%% %6.0f%%  %s%s\n", name,
+               num_ops/(old_mean*1e3), num_ops/(cur_mean*1e3), change, t, old_util*100, cur_util*100,
+               slower ? "THROUGHPUT REGRESSION " : "", lesscompact ? "UTILIZATION REGRESSION" : "");
+        if (slower || lesscompact) regressions++;
+    }
+    printf("%s\n", dashes);
+    if (single)
+        printf("Only one run on a side, throughput changes under %.0f%% are treated as noise.\n", REGRESS_NOISE);
+    if (regressions != 0)
+        printf("%d script%s regressed against baseline %s.\n\n", regressions, regressions > 1 ? "s" : "", before_paths[0]);
+    else
+        printf("No significant regressions against baseline %s.\n\n", before_paths[0]);
+    return regressions ? 1 : 0;
+}
+
+/* Function: record_counters
+ * --------------------------
+ * Saves the hardware counts from the performance trial just run, scaled to
+ * instructions per cycle and misses per request.
+ */
+static void record_counters(result_t *result)
+{
+    fcyc_counters_t counts;
+    result->has_counters = fcyc_counters(&counts) && counts.cycles > 0;
+    if (!result->has_counters) return;
+    result->ipc = counts.instructions >= 0 ? counts.instructions/counts.cycles : -1;
+    result->cache_misses = counts.cache_misses >= 0 ? counts.cache_misses/result->num_ops : -1;
+    result->dtlb_misses = counts.dtlb_misses >= 0 ? counts.dtlb_misses/result->num_ops : -1;
+}
+
+/* Function: print_counters
+ * ------------------------
+ * Prints table of hardware counter results alongside throughput, if any
+ * script was timed with the perf timer.
+ */
+static void print_counters(result_t result[], int n)
+{
+    char *dashes = "-------------------------------------------------------------------------------";
+    bool any = false;
+    for (int i = 0; i < n; i++)
+        any |= result[i].has_counters;
+    if (!any) return;
+
+    printf(" script name            Kreq/sec        IPC   cache-miss/req    dTLB-miss/req\n%s\n", dashes);
+    for (int i = 0; i < n; i++) {
+        if (!result[i].has_counters) continue;
+        printf("%-20s %10d %10.2f %16.3f %16.3f\n", result[i].name, result[i].tput,
+               result[i].ipc, result[i].cache_misses, result[i].dtlb_misses);
+    }
+    printf("%s\n\tCounts are for the best timing sample, -1 where hardware does not provide the counter.\n\n", dashes);
+}
+
 // minor path/string handling helpers
 static char *endswith(char *str, const char *suffix) {
     char *tail = str + strlen(str) - strlen(suffix);
@@ -563,9 +1411,22 @@ static void allocator_error(script_t *script, int lineno, char* format, ...)
 static void usage()
 {
    fprintf(stderr, "Usage: %s [-f <file-or-dir>]\n", program_invocation_short_name);
+   fprintf(stderr, "       %s -C <baseline.json,...> <results.json>...\n", program_invocation_short_name);
    fprintf(stderr, "\t-c                Run only the correctness tests (no checks for performance).\n");
    fprintf(stderr, "\t-p                Run only the performance tests (no checks for correctness).\n");
+   fprintf(stderr, "\t-i <blocks>       Validate heap incrementally, checking at most <blocks> blocks per request.\n");
+   fprintf(stderr, "\t-l                Also record per-request latency histograms (p50/p99/p99.9/max).\n");
+   fprintf(stderr, "\t-t <file>         Write heap timeline samples for each script to <file> (.csv or .json).\n");
+   fprintf(stderr, "\t-o <file>         Write results (with host info and timing variance) to <file> as JSON.\n");
+   fprintf(stderr, "\t-C <base,...>     Compare results file(s) against baseline(s), flag significant regressions.\n");
+   fprintf(stderr, "\t                  Give several independent runs per side (at most %d) for a sound t-test.\n", MAX_RUNS);
+   fprintf(stderr, "\t-T <timer>        Timer backend: tsc, clock (CLOCK_MONOTONIC_RAW) or perf (clock plus\n");
+   fprintf(stderr, "\t                  hardware counters, reports IPC and cache/dTLB misses per request).\n");
+   fprintf(stderr, "\t-a <name,...>     Allocator backend(s): custom (default), libc, bump, fixed, threads. Naming\n");
+   fprintf(stderr, "\t                  more than one replays each script on each, results side by side\n");
+   fprintf(stderr, "\t                  (cannot be combined with -l, -t or -o).\n");
    fprintf(stderr, "\t-f <file-or-dir>  Use <file> as script or read all script files from <dir>.\n");
    fprintf(stderr, "Without -f option, reads scripts from default path: %s\n", DEFAULT_SCRIPT_DIR);
+   fprintf(stderr, "(or if that is unreachable, from ./%s as generated by \"make suite\").\n", LOCAL_SCRIPT_DIR);
    exit(107);
 }
@@ -0,0 +1,76 @@
+/*
+ * File: bigtest.c
+ * ---------------
+ * Checks the allocator with adjacent blocks whose combined size is more
+ * than a 4-byte block header can hold. Each block is as large as a single
+ * request may be, and freeing them side by side (one at a time, then as a
+ * batch) must leave a consistent heap rather than a merged block whose size
+ * has wrapped. Only block headers and footers are touched, so the test
+ * needs address space but little memory. Exits with status 0 if every check
+ * passed, 1 otherwise.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include "allocator.h"
+
+#define NBIG 3
+#define BIG_REQUEST ((size_t)1 << 31)
+
+static int failures;
+
+static void verify(bool ok, const char *what)
+{
+    printf("%s: %s\n", what, ok ? "ok" : "##### PROBLEM HERE #####");
+    if (!ok) failures++;
+}
+
+// Allocates NBIG blocks that lie one after another in the heap
+static bool alloc_big(void *blocks[])
+{
+    for (int i = 0; i < NBIG; i++) {
+        blocks[i] = mymalloc(BIG_REQUEST);
+        if (blocks[i] == NULL) return false;
+        if (i > 0 && ((char *)blocks[i] < (char *)blocks[i - 1] + BIG_REQUEST ||
+                      (char *)blocks[i] > (char *)blocks[i - 1] + BIG_REQUEST + 64)) return false;
+    }
+    return true;
+}
+
+// The heap must be consistent, with all the freed bytes in free blocks. A
+// merged size that wrapped in its header would lose most of them.
+static void check_freed(const char *what)
+{
+    heapstats_t stats;
+    heap_stats(&stats);
+    printf("\n%s.\n", what);
+    verify(validate_heap(), "validate_heap");
+    verify(stats.free_bytes >= NBIG * BIG_REQUEST, "Freed bytes in free blocks");
+}
+
+int main(int argc, char *argv[])
+{
+    void *blocks[NBIG];
+
+    myinit();
+    verify(alloc_big(blocks), "Allocate adjacent blocks");
+    size_t heap_size = heap_total_size();
+    myfree(blocks[0]);
+    myfree(blocks[2]);
+    myfree(blocks[1]); // merges with both neighbors, unless that is too big
+    check_freed("Freed one at a time");
+    bool reused = true;
+    for (int i = 0; i < NBIG; i++)
+        reused &= (blocks[i] = mymalloc(BIG_REQUEST)) != NULL;
+    verify(reused && heap_total_size() == heap_size, "Freed blocks reused without growing heap");
+
+    myinit();
+    verify(alloc_big(blocks), "Allocate adjacent blocks");
+    myfree_batch(blocks, NBIG);
+    check_freed("Freed as a batch");
+    void *again = mymalloc(BIG_REQUEST);
+    verify(again != NULL && validate_heap(), "Allocate from the freed blocks");
+
+    if (failures == 0)
+        printf("\nAll big block tests passed.\n");
+    return failures == 0 ? 0 : 1;
+}
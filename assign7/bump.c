@@ -0,0 +1,81 @@
+/*
+ * File: bump.c
+ * ------------
+ * A bump (region) allocator. Blocks are carved one after another from the
+ * end of the heap segment, each behind an 8-byte header holding its size.
+ * Free is a no-op, except that freeing the most recently allocated block
+ * rolls the bump pointer back over it. Realloc of the most recent block
+ * grows or shrinks it in place, otherwise it allocates and copies.
+ *
+ * Nothing is ever reused, so utilization is as bad as it gets, but each
+ * request is a handful of instructions: this sets the ceiling on throughput
+ * that a real allocator can be measured against.
+ */
+
+#include <string.h>
+#include "bump.h"
+#include "segment.h"
+
+#define ALIGNMENT 8
+
+typedef struct {
+    size_t payloadsz;
+} headerT;
+
+static char *top;       // next free byte in segment
+static headerT *last;   // header of most recently allocated block (NULL if none)
+
+static inline size_t roundup(size_t sz, size_t mult)
+{
+    return (sz + mult-1) & ~(mult-1);
+}
+
+// Extends the segment if needed so that it ends at or after addr
+static bool ensure_segment(char *addr)
+{
+    char *end = (char *)heap_segment_start() + heap_segment_size();
+    if (addr <= end) return true;
+    return extend_heap_segment((addr - end + PAGE_SIZE - 1)/PAGE_SIZE) != NULL;
+}
+
+bool bump_init(void)
+{
+    top = init_heap_segment(0);
+    last = NULL;
+    return top != NULL;
+}
+
+void *bump_malloc(size_t size)
+{
+    size_t blocksz = roundup(size + sizeof(headerT), ALIGNMENT);
+    if (!ensure_segment(top + blocksz)) return NULL;
+    last = (headerT *)top;
+    last->payloadsz = size;
+    top += blocksz;
+    return last + 1;
+}
+
+void *bump_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) return bump_malloc(size);
+    headerT *header = (headerT *)ptr - 1;
+    if (header == last) { // most recent block, resize in place
+        char *newtop = (char *)header + roundup(size + sizeof(headerT), ALIGNMENT);
+        if (!ensure_segment(newtop)) return NULL;
+        header->payloadsz = size;
+        top = newtop;
+        return ptr;
+    }
+    void *newptr = bump_malloc(size);
+    if (newptr != NULL)
+        memcpy(newptr, ptr, header->payloadsz < size ? header->payloadsz : size);
+    return newptr;
+}
+
+void bump_free(void *ptr)
+{
+    if (ptr != NULL && (headerT *)ptr - 1 == last) {
+        top = (char *)last;
+        last = NULL;
+    }
+}
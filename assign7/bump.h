@@ -0,0 +1,18 @@
+/* File: bump.h
+ * ------------
+ * Interface for the bump (region) allocator, a baseline that alloctest can
+ * replay scripts against side by side with the custom allocator. The
+ * functions mirror those of allocator.h.
+ */
+#ifndef _BUMP_H
+#define _BUMP_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+bool bump_init(void);
+void *bump_malloc(size_t size);
+void *bump_realloc(void *ptr, size_t size);
+void bump_free(void *ptr);
+
+#endif
@@ -1,16 +1,32 @@
 /*
  * File: fcyc.c
  * ------------
- * Routines to read x86 cycle counter and do performance
- * measurements based on cycle counts.  This implements the fancy
+ * Routines to read a high-resolution timer and do performance
+ * measurements based on tick counts.  This implements the fancy
  * cache-flushing, K-best scheme given in Ch 5
  * Bryant and O'Hallaron.
+ *
+ * The timer backend is selectable: the invariant x86 timestamp counter,
+ * clock_gettime(CLOCK_MONOTONIC_RAW), or the monotonic clock together with
+ * hardware performance counters read through perf_event_open. The default
+ * is the TSC when the CPU reports it as invariant, the clock otherwise.
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
 
 #include "fcyc.h"
 
@@ -19,73 +35,161 @@
 #define MAXSAMPLES 20        /* Give up after MAXSAMPLES */
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define CLEAR_CACHE 1        /* Clear cache before running test function */
-#define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CACHE_BYTES (1<<19)  /* Max cache size in bytes, if size can't be queried */
+#define CACHE_BLOCK 32       /* Cache block size in bytes, if size can't be queried */
+#define CALIBRATE_NS 50000000  /* Calibrate TSC rate against clock over 50ms */
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
 static double epsilon = EPSILON;
 static int clear_cache = CLEAR_CACHE;
-static int cache_bytes = CACHE_BYTES;
-static int cache_block = CACHE_BLOCK;
+static long cache_bytes = 0;
+static long cache_block = 0;
 
 static int *cache_buf = NULL;
 
 static double *values = NULL;
 static int samplecount = 0;
+static double samplesum = 0;     /* Sum and sum of squares of all samples, */
+static double samplesumsq = 0;   /* not just the K best, for variance */
 
-#if defined(__i386__) || defined(__x86_64__)
+static double Mhz = 0;           /* Estimated TSC frequency */
+static fcyc_timer_t timer;       /* Active backend, */
+static bool timer_chosen = false;  /* default chosen on first use */
 
-// last read value of cycle counter stored in static variables
-// requires two unsigned, upper & lower
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+/* Hardware counters opened for TIMER_PERF, in the order of the
+   fcyc_counters_t fields. An fd of -1 means that counter is unavailable */
+#define NCOUNTERS 4
+static int counter_fds[NCOUNTERS] = {-1, -1, -1, -1};
+static double counter_vals[NCOUNTERS];  /* Counts for current best sample */
+static bool counters_valid = false;
 
 
-/* Set *hi and *lo to the high and low order bits of the cycle counter.
-   Have to use assembly to invoke the rdtsc instruction. */
-void read_counter(unsigned *hi, unsigned *lo)
+static inline uint64_t read_clock(void)
 {
-    asm volatile("rdtsc; movl %%edx,%0; movl %%eax,%1"
-                 : "=r" (*hi), "=r" (*lo)   // two outputs
-                 :                          // no input
-                 : "%edx", "%eax");         // clobber list
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-// Record the current value of the cycle counter
-void start_counter()
+#if defined(__i386__) || defined(__x86_64__)
+/* Read the full 64-bit timestamp counter in one go */
+static inline uint64_t read_tsc(void)
 {
-    read_counter(&cyc_hi, &cyc_lo);
+    unsigned hi, lo;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
 }
 
-// Return the number of cycles since the last call to start_counter()
-double get_counter()
+/* An invariant TSC ticks at a constant rate regardless of frequency
+   scaling and sleep states (CPUID leaf 0x80000007, EDX bit 8) */
+static bool tsc_invariant(void)
 {
-    unsigned ncyc_hi, ncyc_lo;
-    read_counter(&ncyc_hi, &ncyc_lo);
-
-    /* Do double precision subtraction */
-    unsigned lo = ncyc_lo - cyc_lo;
-    unsigned borrow = lo > ncyc_lo;
-    unsigned hi = ncyc_hi - cyc_hi - borrow;
-    double result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0)
-        fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
-    return result;
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8));
 }
+#else
+static inline uint64_t read_tsc(void) { return read_clock(); }
+static bool tsc_invariant(void) { return false; }
 #endif
 
 
-/* Estimate the clock rate by measuring the cycles that elapse */
-/* while sleeping for sleeptime seconds */
+/* Estimate the TSC rate by measuring the ticks that elapse */
+/* against the monotonic clock over a short interval */
 double mhz()
 {
-    int sleeptime = 2;
-    start_counter();
-    sleep(sleeptime);
-    return ((double)get_counter())/(1e6*sleeptime);
+    struct timespec pause = {0, CALIBRATE_NS};
+    uint64_t ns = read_clock(), tsc = read_tsc();
+    nanosleep(&pause, NULL);
+    tsc = read_tsc() - tsc;
+    ns = read_clock() - ns;
+    return (double)tsc*1e3/ns;
+}
+
+/*
+ * fcyc_mhz - Return estimated TSC rate, measured once on first use
+ */
+double fcyc_mhz()
+{
+    if (Mhz <= 0)
+        Mhz = mhz();
+    return Mhz;
+}
+
+
+static long perf_event_open(struct perf_event_attr *attr, int group_fd)
+{
+    return syscall(__NR_perf_event_open, attr, 0, -1, group_fd, 0); // this thread, any cpu
+}
+
+/* Open the counter group, cycles is the group leader and is required */
+static bool open_counters(void)
+{
+    static const struct { unsigned type; unsigned long long config; } events[NCOUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    };
+    if (counter_fds[0] != -1) return true;
+    for (int i = 0; i < NCOUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = (i == 0);   // members follow the leader
+        attr.exclude_kernel = 1;    // permitted at the default paranoid level
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;  // one read returns whole group
+        counter_fds[i] = perf_event_open(&attr, i ? counter_fds[0] : -1);
+        if (i == 0 && counter_fds[0] == -1) return false;
+    }
+    return true;
+}
+
+/*
+ * fcyc_set_timer - Choose timer backend, returns false if unavailable
+ */
+bool fcyc_set_timer(fcyc_timer_t which)
+{
+    if ((which == TIMER_TSC && !tsc_invariant()) || (which == TIMER_PERF && !open_counters()))
+        return false;
+    timer = which;
+    timer_chosen = true;
+    return true;
+}
+
+fcyc_timer_t fcyc_get_timer()
+{
+    if (!timer_chosen)
+        fcyc_set_timer(tsc_invariant() ? TIMER_TSC : TIMER_CLOCK);
+    return timer;
+}
+
+const char *fcyc_timer_name(fcyc_timer_t which)
+{
+    static const char *names[] = {"tsc", "clock", "perf"};
+    return names[which];
+}
+
+/*
+ * fcyc_now - Current timer value in ticks. The perf backend timestamps with
+ * the monotonic clock, counters are only read around a whole fcyc trial.
+ */
+uint64_t fcyc_now()
+{
+    return fcyc_get_timer() == TIMER_TSC ? read_tsc() : read_clock();
 }
 
+/*
+ * fcyc_ticks_per_sec - Rate of the ticks returned by fcyc_now/fcyc
+ */
+double fcyc_ticks_per_sec()
+{
+    return fcyc_get_timer() == TIMER_TSC ? fcyc_mhz()*1e6 : 1e9;
+}
 
 
 /*
@@ -93,14 +197,37 @@ double mhz()
  */
 double fsecs(void (*fn)(void *), void *argp)
 {
-	static double Mhz;  // estimated CPU clock frequency
-    static bool init = false;
-	if (!init) {
-	    Mhz = mhz();
-        init = true;
-     }
-     double cycles = fcyc(fn, argp);
-     return cycles/(Mhz*1e6);
+     double rate = fcyc_ticks_per_sec();
+     double ticks = fcyc(fn, argp);
+     return ticks/rate;
+}
+
+/*
+ * fsecs_samples - Report on all samples taken by the most recent fsecs
+ * call: the number of samples and their mean and standard deviation in secs
+ */
+void fsecs_samples(int *count, double *mean, double *stddev)
+{
+    double scale = fcyc_ticks_per_sec();
+    double m = samplecount ? samplesum/samplecount : 0;
+    double var = samplecount > 1 ? (samplesumsq - samplecount*m*m)/(samplecount - 1) : 0;
+    *count = samplecount;
+    *mean = m/scale;
+    *stddev = (var > 0 ? sqrt(var) : 0)/scale;
+}
+
+/*
+ * fcyc_counters - Hardware counts for the best sample of the most recent
+ * fcyc call. Counters the hardware does not provide are reported as -1.
+ * Returns false if the perf backend was not active for that call.
+ */
+bool fcyc_counters(fcyc_counters_t *counts)
+{
+    counts->cycles = counter_vals[0];
+    counts->instructions = counter_vals[1];
+    counts->cache_misses = counter_vals[2];
+    counts->dtlb_misses = counter_vals[3];
+    return counters_valid;
 }
 
 
@@ -111,20 +238,25 @@ static void init_sampler()
 {
     values = calloc(kbest, sizeof(double));
     samplecount = 0;
+    samplesum = samplesumsq = 0;
 }
 
 /*
- * add_sample - Add new sample
+ * add_sample - Add new sample, returns true if it is the new best
  */
-static void add_sample(double val)
+static bool add_sample(double val)
 {
     int pos = 0;
+    samplesum += val;
+    samplesumsq += val*val;
     if (samplecount < kbest) {
         pos = samplecount;
         values[pos] = val;
     } else if (val < values[kbest-1]) {
         pos = kbest-1;
         values[pos] = val;
+    } else {
+        pos = -1;
     }
     samplecount++;
     /* Insertion sort */
@@ -134,6 +266,7 @@ static void add_sample(double val)
         values[pos] = temp;
         pos--;
     }
+    return pos == 0;
 }
 
 /*
@@ -156,12 +289,22 @@ static void cleanup()
     cache_buf = NULL;
 }
 
+/* Size the flush buffer to twice the largest cache level the system reports */
+static void size_cache()
+{
+    long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (llc <= 0) llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    cache_bytes = (llc > 0) ? 2*llc : CACHE_BYTES;
+    cache_block = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+    if (cache_block <= 0) cache_block = CACHE_BLOCK;
+}
+
 static void clear()
 {
     int x = sink;
     int *cptr, *cend;
-    int incr = cache_block/sizeof(int);
     if (!cache_buf) {
+        size_cache();
         cache_buf = malloc(cache_bytes);
         if (!cache_buf) {
             fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
@@ -169,6 +312,7 @@ static void clear()
         }
        atexit(cleanup);
     }
+    int incr = cache_block/sizeof(int);
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
     while (cptr < cend) {
@@ -178,25 +322,50 @@ static void clear()
     sink = x;
 }
 
+/* Read the counter group, format is {nr, value[nr]} */
+static void read_counters(double vals[])
+{
+    uint64_t buf[1 + NCOUNTERS];
+    int n = 0;
+    if (read(counter_fds[0], buf, sizeof(buf)) <= 0) buf[0] = 0;
+    for (int i = 0; i < NCOUNTERS; i++)
+        vals[i] = (counter_fds[i] != -1 && n < buf[0]) ? buf[1 + n++] : -1;
+}
+
 /*
  * fcyc - Use K-best scheme to estimate the running time of function f
+ * (in ticks of the active timer)
  */
 double fcyc(test_funct f, void *argp)
 {
     double result;
+    bool perf = (fcyc_get_timer() == TIMER_PERF);
+    double counts[NCOUNTERS];
+
     init_sampler();
+    counters_valid = false;
     do {
         double cyc;
         if (clear_cache)
             clear();
-        start_counter();
+        if (perf) {
+            ioctl(counter_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(counter_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+        uint64_t start = fcyc_now();
         f(argp);
-        cyc = get_counter();
-        add_sample(cyc);
+        cyc = fcyc_now() - start;
+        if (perf) {
+            ioctl(counter_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            read_counters(counts);
+        }
+        if (add_sample(cyc) && perf) {
+            memcpy(counter_vals, counts, sizeof(counts));
+            counters_valid = true;
+        }
     } while (!has_converged() && samplecount < maxsamples);
     result = values[0];
     free(values);
     values = NULL;
     return result;
 }
-
@@ -9,13 +9,44 @@
 #ifndef _CYC_H
 #define _CYC_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 /* The test function takes a generic pointer as input */
 typedef void (*test_funct)(void *);
 
-/* Compute number of cycles used by test function f */
+/* Timer backends: invariant timestamp counter (ticks are cycles),
+   CLOCK_MONOTONIC_RAW (ticks are ns), or the clock plus hardware counters */
+typedef enum { TIMER_TSC, TIMER_CLOCK, TIMER_PERF } fcyc_timer_t;
+
+/* Hardware counts for one run of the test function, -1 if unavailable */
+typedef struct {
+    double cycles, instructions, cache_misses, dtlb_misses;
+} fcyc_counters_t;
+
+/* Compute number of timer ticks used by test function f */
 double fcyc(test_funct f, void* argp);
 
 /* Compute number of seconds used by test function f */
 double fsecs(test_funct f, void* argp);
 
+/* Count, mean and standard deviation (in secs) of all samples taken by last fsecs */
+void fsecs_samples(int *count, double *mean, double *stddev);
+
+/* Hardware counts for best sample of last fcyc, false unless TIMER_PERF active */
+bool fcyc_counters(fcyc_counters_t *counts);
+
+/* Select timer backend (false if not available on this machine), default
+   is TIMER_TSC if the TSC is invariant, otherwise TIMER_CLOCK */
+bool fcyc_set_timer(fcyc_timer_t which);
+fcyc_timer_t fcyc_get_timer(void);
+const char *fcyc_timer_name(fcyc_timer_t which);
+
+/* Current value of the active timer, and the rate at which it ticks */
+uint64_t fcyc_now(void);
+double fcyc_ticks_per_sec(void);
+
+/* Estimated TSC rate in MHz */
+double fcyc_mhz(void);
+
 #endif
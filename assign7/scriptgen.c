@@ -0,0 +1,357 @@
+/*
+ * File: scriptgen.c
+ * -----------------
+ * Generates allocator test scripts (in the format read by alloctest) from
+ * parametric workload models, so the allocator can be benchmarked without
+ * access to the class sample scripts.
+ *
+ * A model is a sequence of one or more phases. Each phase draws request sizes
+ * and block lifetimes (measured in requests) from its own distributions and
+ * may resize a fraction of live blocks with realloc. An optional live-set
+ * target caps the bytes in use: when exceeded, the blocks closest to the end
+ * of their lifetime are freed early. All randomness comes from a seeded
+ * generator that is private to this program, the same seed and options
+ * produce the same script on any machine.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_PHASES  8
+#define FOREVER     INT_MAX     // lifetime of a block that lives to end of script
+#define MAX_SIZE    (1 << 24)   // upper bound on any single request
+#define MAX_REALLOCS 32         // consecutive reallocs before an allocation is forced
+
+// Parametric distribution. Kinds and their parameters (a, b, c):
+//   fixed:N             always N
+//   uniform:LO,HI       uniform integer in [LO, HI]
+//   bimodal:A,B,P       A with probability P, else B
+//   powerlaw:LO,HI,ALPHA  truncated power law, density proportional to x^-ALPHA
+//   exp:MEAN            exponential with given mean
+//   forever             never ends (lifetimes only)
+typedef struct {
+    enum { Fixed, Uniform, Bimodal, PowerLaw, Exponential, Forever } kind;
+    double a, b, c;
+} dist_t;
+
+// One phase of the workload model
+typedef struct {
+    dist_t size;            // size of each allocation request
+    dist_t lifetime;        // number of requests a block stays live
+    double realloc_pct;     // percent of requests that realloc a live block
+    double growth;          // realloc resizes by this factor
+} phase_t;
+
+typedef struct {
+    int nallocs;            // total allocation requests, split evenly across phases
+    uint64_t seed;
+    size_t live_target;     // max bytes in use (0 for no limit)
+    phase_t phases[MAX_PHASES];
+    int nphases;
+} model_t;
+
+// A live block, kept in a min-heap ordered by time of death
+typedef struct {
+    int id;
+    size_t size;
+    long death;
+} live_t;
+
+typedef struct {
+    live_t *blocks;
+    int count, capacity;
+    size_t bytes;
+} liveset_t;
+
+static uint64_t rng_state;
+
+static void usage(void);
+static void fatal_error(char *format, ...);
+
+
+/* Function: next_random
+ * ---------------------
+ * Returns a uniformly distributed double in [0, 1). Uses splitmix64, which is
+ * small, fast and gives identical sequences regardless of libc version.
+ */
+static double next_random(void)
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / (1ULL << 53));
+}
+
+// Draws one value from the distribution, rounded to a whole number
+static long sample(const dist_t *d)
+{
+    double u = next_random();
+    switch (d->kind) {
+        case Fixed:       return d->a;
+        case Uniform:     return d->a + (long)(u * (d->b - d->a + 1));
+        case Bimodal:     return u < d->c ? d->a : d->b;
+        case Exponential: return lround(-d->a * log(1 - u));
+        case Forever:     return FOREVER;
+        case PowerLaw:
+            if (fabs(d->c - 1) < 1e-9)  // alpha of 1 is the log-uniform special case
+                return lround(d->a * pow(d->b/d->a, u));
+            double lo = pow(d->a, 1 - d->c), hi = pow(d->b, 1 - d->c);
+            return lround(pow(lo + u*(hi - lo), 1/(1 - d->c)));
+    }
+    return 0;
+}
+
+/* Function: parse_dist
+ * --------------------
+ * Parses a distribution spec such as "powerlaw:16,4096,1.5" (see dist_t).
+ * Raises fatal error on malformed spec.
+ */
+static dist_t parse_dist(const char *spec)
+{
+    static const struct { const char *name; int kind, nparams; } kinds[] = {
+        {"fixed", Fixed, 1}, {"uniform", Uniform, 2}, {"bimodal", Bimodal, 3},
+        {"powerlaw", PowerLaw, 3}, {"exp", Exponential, 1}, {"forever", Forever, 0},
+    };
+    dist_t d = {0};
+    char name[32];
+    int len = 0;
+
+    if (sscanf(spec, "%31[a-z]%n", name, &len) == 1) {
+        for (int i = 0; i < sizeof(kinds)/sizeof(kinds[0]); i++) {
+            if (strcmp(name, kinds[i].name) != 0) continue;
+            d.kind = kinds[i].kind;
+            int n = kinds[i].nparams ? sscanf(spec + len, ":%lf,%lf,%lf", &d.a, &d.b, &d.c) : 0;
+            if (n == kinds[i].nparams && (d.kind == Forever || d.a >= 0) && (d.kind != Uniform || d.b >= d.a)
+                && (d.kind != PowerLaw || (d.a > 0 && d.b >= d.a)))
+                return d;
+        }
+    }
+    fatal_error("Malformed distribution \"%s\".\n", spec);
+    return d;
+}
+
+
+// Min-heap helpers keyed on death time, heap position 0 is the next to die
+static void swap_live(liveset_t *ls, int i, int j)
+{
+    live_t tmp = ls->blocks[i];
+    ls->blocks[i] = ls->blocks[j];
+    ls->blocks[j] = tmp;
+}
+
+static void push_live(liveset_t *ls, live_t block)
+{
+    if (ls->count == ls->capacity) {
+        ls->capacity = ls->capacity ? 2*ls->capacity : 1024;
+        ls->blocks = realloc(ls->blocks, ls->capacity*sizeof(live_t));
+        if (!ls->blocks) fatal_error("Out of memory.\n");
+    }
+    int i = ls->count++;
+    ls->blocks[i] = block;
+    ls->bytes += block.size;
+    while (i > 0 && ls->blocks[(i-1)/2].death > ls->blocks[i].death) {
+        swap_live(ls, i, (i-1)/2);
+        i = (i-1)/2;
+    }
+}
+
+static live_t pop_live(liveset_t *ls)
+{
+    live_t top = ls->blocks[0];
+    ls->blocks[0] = ls->blocks[--ls->count];
+    ls->bytes -= top.size;
+    for (int i = 0; ; ) {
+        int smallest = i, left = 2*i + 1, right = 2*i + 2;
+        if (left < ls->count && ls->blocks[left].death < ls->blocks[smallest].death) smallest = left;
+        if (right < ls->count && ls->blocks[right].death < ls->blocks[smallest].death) smallest = right;
+        if (smallest == i) break;
+        swap_live(ls, i, smallest);
+        i = smallest;
+    }
+    return top;
+}
+
+
+/* Function: generate
+ * ------------------
+ * Writes the script for the model to fp. Before each request, blocks whose
+ * lifetime has expired are freed, then blocks are freed early if the live set
+ * is above target. The request itself is a realloc of a random live block
+ * (with probability realloc_pct) or a new allocation. At most MAX_REALLOCS
+ * reallocs are made in a row, so every phase ends even when its blocks are
+ * never freed. Any blocks still live at the end are freed, so the script
+ * leaves an empty heap.
+ */
+static void generate(const model_t *m, FILE *fp)
+{
+    liveset_t ls = {0};
+    int nextid = 0;
+    long now = 0;
+    int nreallocs = 0;  // since the last allocation
+
+    rng_state = m->seed;
+    for (int p = 0; p < m->nphases; p++) {
+        const phase_t *ph = &m->phases[p];
+        int nallocs = m->nallocs/m->nphases + (p < m->nallocs % m->nphases);
+        fprintf(fp, "# phase %d: %d allocations\n", p + 1, nallocs);
+
+        for (int n = 0; n < nallocs; now++) {
+            while (ls.count > 0 && (ls.blocks[0].death <= now || (m->live_target && ls.bytes > m->live_target)))
+                fprintf(fp, "f %d\n", pop_live(&ls).id);
+
+            if (ls.count > 0 && nreallocs < MAX_REALLOCS && next_random()*100 < ph->realloc_pct) {
+                live_t *b = &ls.blocks[(int)(next_random()*ls.count)];
+                size_t newsz = b->size*ph->growth + 1;
+                if (newsz > MAX_SIZE) newsz = MAX_SIZE;
+                ls.bytes += newsz - b->size;
+                b->size = newsz;
+                fprintf(fp, "r %d %zu\n", b->id, b->size);
+                nreallocs++;
+            } else {
+                long size = sample(&ph->size), life = sample(&ph->lifetime);
+                live_t b = {.id = nextid++, .size = size < 0 ? 0 : (size > MAX_SIZE ? MAX_SIZE : size)};
+                b.death = (life >= FOREVER) ? LONG_MAX : now + (life < 1 ? 1 : life);
+                fprintf(fp, "a %d %zu\n", b.id, b.size);
+                push_live(&ls, b);
+                nreallocs = 0;
+                n++;
+            }
+        }
+    }
+    while (ls.count > 0)
+        fprintf(fp, "f %d\n", pop_live(&ls).id);
+    free(ls.blocks);
+}
+
+
+/* Standard suite
+ * --------------
+ * Covers small-object churn, large objects, fragmentation induced by mixing
+ * lifetimes, realloc growth, phase changes, a steady state at a fixed live
+ * set, and churn of a couple of fixed struct sizes. Each entry is a name and the option string it is generated from.
+ */
+static const struct { const char *name, *options; } suite[] = {
+    {"small-objects", "-n 20000 -d powerlaw:8,256,1.8 -l exp:500"},
+    {"large-objects", "-n 2000 -d uniform:16384,1048576 -l exp:20 -L 33554432"},
+    {"fragment", "-n 12000 -d bimodal:24,2040,0.5 -l uniform:1,6000 -d fixed:4000 -l exp:40"},
+    {"realloc-growth", "-n 5000 -d powerlaw:8,512,1.5 -l exp:2000 -r 30:1.5"},
+    {"phased", "-n 15000 -d powerlaw:8,128,2 -l exp:300 -d uniform:2048,65536 -l exp:50 -d powerlaw:8,128,2 -l exp:300"},
+    {"steady-live", "-n 20000 -d uniform:8,8192 -l forever -L 4194304"},
+    {"structs", "-n 30000 -d bimodal:16,48,0.6 -l exp:1000"},
+};
+
+static void parse_model(int argc, char *argv[], model_t *m);
+
+// Writes each script of the standard suite into dir
+static void write_suite(const char *dir)
+{
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        fatal_error("Could not create directory \"%s\".\n", dir);
+    for (int i = 0; i < sizeof(suite)/sizeof(suite[0]); i++) {
+        char buf[256], path[PATH_MAX], *argv[32] = {"scriptgen"};
+        int argc = 1;
+        strcpy(buf, suite[i].options);
+        for (char *tok = strtok(buf, " "); tok && argc < 31; tok = strtok(NULL, " "))
+            argv[argc++] = tok;
+        model_t m;
+        optind = 0;  // glibc: reinitialize getopt for the new argument vector
+        parse_model(argc, argv, &m);
+        sprintf(path, "%s/%s.script", dir, suite[i].name);
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL)
+            fatal_error("Could not open \"%s\" for writing.\n", path);
+        fprintf(fp, "# %s: scriptgen -s %lu %s\n", suite[i].name, (unsigned long)m.seed, suite[i].options);
+        generate(&m, fp);
+        fclose(fp);
+        printf("Wrote %s\n", path);
+    }
+}
+
+/* Function: parse_model
+ * ---------------------
+ * Builds model from command-line options. Each -d starts a new phase, the -l
+ * and -r options that follow it configure that phase. Any -l and -r given
+ * before the first -d configure the first phase.
+ */
+static void parse_model(int argc, char *argv[], model_t *m)
+{
+    phase_t defaults = {.size = {Uniform, 8, 1024}, .lifetime = {Exponential, 100}, .realloc_pct = 0, .growth = 1.5};
+    *m = (model_t){.nallocs = 10000, .seed = 1, .nphases = 0};
+    m->phases[0] = defaults;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:s:d:l:r:L:S:")) != EOF) {
+        phase_t *cur = &m->phases[m->nphases ? m->nphases - 1 : 0];
+        switch (c) {
+            case 'n': m->nallocs = atoi(optarg); break;
+            case 's': m->seed = strtoull(optarg, NULL, 10); break;
+            case 'L': m->live_target = strtoull(optarg, NULL, 10); break;
+            case 'l': cur->lifetime = parse_dist(optarg); break;
+            case 'd':
+                if (m->nphases == MAX_PHASES)
+                    fatal_error("At most %d phases.\n", MAX_PHASES);
+                if (m->nphases > 0) // phase 0 may already hold options given before the first -d
+                    m->phases[m->nphases] = defaults;
+                m->phases[m->nphases++].size = parse_dist(optarg);
+                break;
+            case 'r':
+                if (sscanf(optarg, "%lf:%lf", &cur->realloc_pct, &cur->growth) < 1)
+                    fatal_error("Malformed realloc option \"%s\".\n", optarg);
+                if (cur->realloc_pct < 0 || cur->realloc_pct >= 100) usage();
+                break;
+            case 'S':
+                write_suite(optarg);
+                exit(0);
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || m->nallocs <= 0) usage();
+    if (m->nphases == 0) m->nphases = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    model_t m;
+    parse_model(argc, argv, &m);
+    generate(&m, stdout);
+    return 0;
+}
+
+// fatal_error - Report an error and exit
+static void fatal_error(char *format, ...)
+{
+    fprintf(stderr, "FATAL ERROR: ");
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(107);
+}
+
+static void usage(void)
+{
+   fprintf(stderr, "Usage: %s [options] > name.script\n", program_invocation_short_name);
+   fprintf(stderr, "       %s -S <dir>\n", program_invocation_short_name);
+   fprintf(stderr, "\t-n <count>         Number of allocation requests (default 10000).\n");
+   fprintf(stderr, "\t-s <seed>          Seed for random generator (default 1).\n");
+   fprintf(stderr, "\t-d <dist>          Start a new phase with this request size distribution.\n");
+   fprintf(stderr, "\t-l <dist>          Block lifetime distribution (in requests) for current phase.\n");
+   fprintf(stderr, "\t-r <pct>[:<grow>]  Percent (0 to under 100) of requests in current phase that realloc\n");
+   fprintf(stderr, "\t                   by factor grow.\n");
+   fprintf(stderr, "\t-L <bytes>         Live-set target, blocks are freed early to stay below it.\n");
+   fprintf(stderr, "\t-S <dir>           Write the standard benchmark suite into <dir>.\n");
+   fprintf(stderr, "Distributions: fixed:N uniform:LO,HI bimodal:A,B,P powerlaw:LO,HI,ALPHA exp:MEAN forever\n");
+   exit(107);
+}
@@ -1,64 +1,180 @@
 /* File: segment.c
  * ---------------
- * Handles low-level storage underneath the dynamic allocator. It reserves
- * the large memory segment using the OS-level mmap facility and then
- * opens it up on demand based on calls to extend.
+ * Handles low-level storage underneath the dynamic allocator. Each segment
+ * reserves a large range of addresses using the OS-level mmap facility and
+ * then opens it up on demand based on calls to extend. The heap_segment
+ * functions work on one default segment, the segment_ functions on any
+ * segment the caller keeps.
  */
 
+#define _GNU_SOURCE // for fallocate
 #include "segment.h"
+#include <fcntl.h>
+#include <stdint.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 // Place the heap at lower address, as default addresses are quite high and easily
 // mistaken for stack addresses
 #define HEAP_START_HINT (void *)0x1070000000L
 
 // Entire segment is 8 GB
+#ifndef MAX_SEGMENT_SIZE
 #define MAX_SEGMENT_SIZE (1L << 33)
+#endif
 
-// static variables track state of heap segment
-static void * segment_start = NULL;
-static size_t segment_size = 0;
+// Segments placed by the OS start on a multiple of this
+#define SEGMENT_ALIGN (1L << 21)
+
+// the default segment, used by the heap_segment functions
+static segment_t heap_segment;
 
 void *heap_segment_start()
 {
-    return segment_start;
+    return heap_segment.start;
 }
 
 size_t heap_segment_size()
 {
-    return segment_size;
+    return heap_segment.size;
 }
 
 
+// Discard the segment's reservation and forget its file, if any
+void segment_release(segment_t *seg)
+{
+    if (seg->start != NULL) munmap(seg->start, MAX_SEGMENT_SIZE);
+    if (seg->shared) close(seg->fd);
+    *seg = (segment_t){.start = NULL};
+}
+
 // Discard any previous segment by unmapping old segment
-// Re-initialize by reserving new segment with mmap
+// Reserve new segment with mmap, with no pages yet accessible. Without a
+// hint the reservation is made SEGMENT_ALIGN larger, and the slack on either
+// side of the aligned start is unmapped again.
+static bool reserve_segment(segment_t *seg, void *hint)
+{
+    segment_release(seg);
+    size_t slack = hint ? 0 : SEGMENT_ALIGN;
+    char *start = mmap(hint, MAX_SEGMENT_SIZE + slack, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (start == MAP_FAILED) return false; // allocation failure
+    if (slack) {
+        char *aligned = (char *)(((uintptr_t)start + SEGMENT_ALIGN - 1) & ~(uintptr_t)(SEGMENT_ALIGN - 1));
+        if (aligned > start) munmap(start, aligned - start);
+        munmap(aligned + MAX_SEGMENT_SIZE, start + slack - aligned);
+        start = aligned;
+    }
+    seg->start = start;
+    return true;
+}
+
+void *segment_init(segment_t *seg, size_t npages)
+{
+    if (!reserve_segment(seg, NULL)) return NULL;
+    return segment_extend(seg, npages);
+}
+
+// Re-initialize by reserving new segment
 void *init_heap_segment(size_t npages)
 {
-    if (segment_start != NULL) { // discard existing segment
-        if (munmap(segment_start, MAX_SEGMENT_SIZE) == -1) return NULL;
-        segment_start = NULL;
+    if (!reserve_segment(&heap_segment, HEAP_START_HINT)) return NULL;
+    return segment_extend(&heap_segment, npages);
+}
+
+
+// Reserve new segment as for init, then map the file contents over the
+// start of it. Private mapping is copy-on-write, so the file is never
+// changed and pages are only read in as they are touched. A shared mapping
+// keeps its own descriptor so it can grow the file later.
+void *attach_heap_segment(int fd, off_t offset, size_t npages, bool shared, bool writable)
+{
+    segment_t *seg = &heap_segment;
+    if (!reserve_segment(seg, HEAP_START_HINT)) return NULL;
+    size_t size = npages*PAGE_SIZE;
+    int prot = writable ? PROT_READ|PROT_WRITE : PROT_READ;
+    if (size > MAX_SEGMENT_SIZE ||
+        mmap(seg->start, size, prot, (shared ? MAP_SHARED : MAP_PRIVATE)|MAP_FIXED, fd, offset) == MAP_FAILED)
+        return NULL;
+    if (shared && writable) {
+        if ((seg->fd = dup(fd)) == -1) return NULL;
+        seg->shared = true;
+        seg->file_offset = offset;
     }
-    // reserve entire segment in advance
-    if ((segment_start = mmap(HEAP_START_HINT, MAX_SEGMENT_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
-        return NULL; // allocation failure
-    segment_size = 0;
-    return extend_heap_segment(npages);
+    seg->size = size;
+    return seg->start;
+}
+
+
+bool sync_heap_segment(void)
+{
+    return heap_segment.start != NULL && msync(heap_segment.start, heap_segment.size, MS_SYNC) == 0;
 }
 
 
 // Extend the segment and return the start address of new pages
-void *extend_heap_segment(size_t npages)
+void *segment_extend(segment_t *seg, size_t npages)
 {
-    if (segment_start == NULL) return NULL; // init has not been called?
+    if (seg->start == NULL) return NULL; // init has not been called?
 
-    void *previous_end = (char *)segment_start + segment_size;
+    void *previous_end = (char *)seg->start + seg->size;
     if (npages <= 0) return previous_end;
     size_t increment_size = npages*PAGE_SIZE;
-    if (increment_size > MAX_SEGMENT_SIZE || (segment_size + increment_size) > MAX_SEGMENT_SIZE)
+    if (increment_size > MAX_SEGMENT_SIZE || (seg->size + increment_size) > MAX_SEGMENT_SIZE)
         return NULL;  // cannot extend beyond max size
-    segment_size += increment_size;
-    if (mprotect(previous_end, increment_size, PROT_READ|PROT_WRITE) == -1)
+    if (seg->shared) { // grow file (new part reads as zeros), map it in
+        if (ftruncate(seg->fd, seg->file_offset + seg->size + increment_size) == -1 ||
+            mmap(previous_end, increment_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+                 seg->fd, seg->file_offset + seg->size) == MAP_FAILED)
+            return NULL;
+    } else if (mprotect(previous_end, increment_size, PROT_READ|PROT_WRITE) == -1) {
         return NULL;  // allocation failure
+    }
+    seg->size += increment_size;
     return previous_end;
 }
 
+void *extend_heap_segment(size_t npages)
+{
+    return segment_extend(&heap_segment, npages);
+}
+
+
+// Drop the pages' contents first so they do not linger in memory while
+// inaccessible, then take away access
+bool segment_shrink(segment_t *seg, size_t npages)
+{
+    size_t decrement_size = npages*PAGE_SIZE;
+    if (seg->start == NULL || decrement_size > seg->size) return false;
+    void *new_end = (char *)seg->start + seg->size - decrement_size;
+    if (seg->shared) { // put back reserved anonymous pages, cut file
+        if (mmap(new_end, decrement_size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0) == MAP_FAILED ||
+            ftruncate(seg->fd, seg->file_offset + seg->size - decrement_size) == -1)
+            return false;
+    } else if (!segment_discard(seg, new_end, npages) || mprotect(new_end, decrement_size, PROT_NONE) == -1) {
+        return false;
+    }
+    seg->size -= decrement_size;
+    return true;
+}
+
+bool shrink_heap_segment(size_t npages)
+{
+    return segment_shrink(&heap_segment, npages);
+}
+
+
+// Dropping a shared mapping's pages would not clear the file, so for a
+// shared segment the range is punched out of the file instead
+bool segment_discard(segment_t *seg, void *addr, size_t npages)
+{
+    if (npages == 0) return true;
+    if (seg->shared)
+        return fallocate(seg->fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                         seg->file_offset + ((char *)addr - (char *)seg->start), npages*PAGE_SIZE) == 0;
+    return madvise(addr, npages*PAGE_SIZE, MADV_DONTNEED) == 0;
+}
+
+bool discard_heap_pages(void *addr, size_t npages)
+{
+    return segment_discard(&heap_segment, addr, npages);
+}
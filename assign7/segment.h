@@ -6,11 +6,19 @@
  * malloc requests. The segment is allocated in page-size chunks.
  * There is an upper bound on the total segment size. If you attempt to extend
  * the segment beyond that bound, NULL is returned to indicate failure.
+ *
+ * The heap_segment functions manage a single default segment at a fixed
+ * address. The segment_ functions manage any number of further segments,
+ * each described by a segment_t the caller keeps, placed wherever the OS
+ * has room. A heap that outgrows one segment can carry on in another, and
+ * separate heaps in one process can each have segments of their own.
  */
 
 #ifndef _SEGMENT_H_
 #define _SEGMENT_H_
+#include <stdbool.h> // for bool
 #include <stddef.h> // for size_t
+#include <sys/types.h> // for off_t
 
 /* Constants
  * ---------
@@ -21,6 +29,21 @@
 #define PAGE_SIZE 4096
 
 
+/* Type: segment_t
+ * ---------------
+ * State of one segment. A segment_t must start out zeroed (an unused
+ * segment has start NULL) and is only changed by the functions below.
+ * start and size give the current extent of the segment.
+ */
+typedef struct {
+    void *start;        // base address, NULL if not reserved
+    size_t size;        // bytes accessible from start
+    bool shared;        // mapped from a file, which fd refers to
+    int fd;
+    off_t file_offset;  // file position of start
+} segment_t;
+
+
 /* Function: init_heap_segment
  * ---------------------------
  * This function is called to initialize the heap segment and allocate the
@@ -36,6 +59,29 @@ void *init_heap_segment(size_t npages);
 
 
 
+/* Function: attach_heap_segment
+ * -----------------------------
+ * Like init_heap_segment, but the first npages of the new segment are
+ * mapped from the file open on fd, starting at the page-aligned offset.
+ * A private mapping starts out with the file's contents, but changes are
+ * never written back to it. A shared mapping writes changes through to
+ * the file, and if writable the file grows and shrinks with the segment
+ * (the segment keeps its own duplicate of fd). A segment that is not
+ * writable must not be extended. Returns the base address of the segment,
+ * or NULL on failure. The caller must check the base address is the one it
+ * expects if the contents hold pointers.
+ */
+void *attach_heap_segment(int fd, off_t offset, size_t npages, bool shared, bool writable);
+
+
+/* Function: sync_heap_segment
+ * ---------------------------
+ * Flushes a shared segment's changes to its file, waiting until written.
+ * Returns false on failure.
+ */
+bool sync_heap_segment(void);
+
+
 /* Function: extend_heap_segment
  * -----------------------------
  * This function is called to extend the size of the existing heap segment. The
@@ -48,6 +94,45 @@ void *init_heap_segment(size_t npages);
 void *extend_heap_segment(size_t npages);
 
 
+/* Function: shrink_heap_segment
+ * -----------------------------
+ * Gives back the last npages of the heap segment. The pages are returned to
+ * the OS and made inaccessible until a later extend_heap_segment brings them
+ * back (zero-filled). Returns false if the segment holds fewer than npages.
+ */
+bool shrink_heap_segment(size_t npages);
+
+
+/* Function: discard_heap_pages
+ * ----------------------------
+ * Tells the OS the contents of npages pages starting at page-aligned addr
+ * within the segment are no longer needed. The pages stay accessible, but
+ * their physical memory is released and they read back as zeros. Returns
+ * false on failure.
+ */
+bool discard_heap_pages(void *addr, size_t npages);
+
+
+/* Functions: segment_init, segment_extend, segment_shrink, segment_discard
+ * ------------------------------------------------------------------------
+ * Same as init_heap_segment, extend_heap_segment, shrink_heap_segment and
+ * discard_heap_pages, but for the segment seg. segment_init places the
+ * segment at an address chosen by the OS, aligned to at least 2 MB.
+ */
+void *segment_init(segment_t *seg, size_t npages);
+void *segment_extend(segment_t *seg, size_t npages);
+bool segment_shrink(segment_t *seg, size_t npages);
+bool segment_discard(segment_t *seg, void *addr, size_t npages);
+
+
+/* Function: segment_release
+ * -------------------------
+ * Gives the whole segment back to the OS. Its addresses become invalid and
+ * seg is left unused, ready for another segment_init.
+ */
+void segment_release(segment_t *seg);
+
+
 /* Functions: heap_segment_start, heap_segment_size
  * ------------------------------------------------
  * heap_segment_start returns the base address of the current heap segment
@@ -19,7 +19,7 @@ typedef struct _cell {
 // string s. head is passed by ref to change to point to new cell
 static void push(cell **head, char *s)
 {
-   cell *c = (cell *)mymalloc(sizeof(cell));
+   cell *c = MYNEW(cell);
    c->next = *head;
    c->string = mymalloc(strlen(s)+1);
    strcpy(c->string, s);
@@ -41,7 +41,7 @@ static void free_list(cell *head)
    while (head != NULL) {
       cell *next = head->next;
       myfree(head->string);
-      myfree(head);
+      myfree_fixed(head);
       head = next;
    }
 }
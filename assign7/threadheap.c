@@ -0,0 +1,314 @@
+/*
+ * File: threadheap.c
+ * ------------------
+ * An ownership-based allocator for multithreaded clients. The heap segment
+ * is carved into spans of SPAN_SIZE bytes, aligned so that the span holding
+ * any block is found by masking its address. Each thread gets its own heap,
+ * which owns a set of spans per size class. A span hands out blocks of one
+ * size from its local free list, or failing that by bumping through its
+ * uncarved tail. The owning thread is the only one that touches those
+ * lists, so the common malloc/free path takes no lock and shares no
+ * cache lines with other threads.
+ *
+ * A block freed by a thread that does not own it is pushed onto the owner's
+ * remote queue, a lock-free multi-producer/single-consumer stack. The owner
+ * takes the whole stack with one atomic exchange at the start of its next
+ * allocation and returns each block to its span. A thread that exits leaves
+ * its heap orphaned. The next new thread adopts it, remote queue included,
+ * rather than starting a fresh one.
+ *
+ * Requests too large for a size class get a run of whole spans to
+ * themselves. Runs, fresh spans and heap records come from a small shared
+ * pool under span_lock, which is only taken when a thread needs more memory.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "threadheap.h"
+#include "segment.h"
+
+#define SPAN_PAGES 16
+#define SPAN_SIZE (SPAN_PAGES * PAGE_SIZE)
+#define SPAN_HEADER 64                  // span_t padded to one cache line
+#define CACHE_LINE 64
+#define SMALL_STEP 16                   // classes below SMALL_MAX are multiples of this
+#define SMALL_MAX 256
+#define LARGE_MIN (SPAN_SIZE / 8)       // requests above this get their own run of spans
+#define NCLASSES (SMALL_MAX/SMALL_STEP + 5) // 16 small classes, then 512 .. 8192
+
+typedef struct threadheap threadheap_t;
+
+// Header at the start of every span
+typedef struct span {
+    threadheap_t *owner;        // heap that allocates from this span (NULL for large run)
+    size_t block_size;          // size of every block in span, or usable size of large run
+    size_t nspans;              // number of spans in this run (1 unless large)
+    void *free;                 // owner-local list of freed blocks
+    char *bump, *end;           // uncarved tail of span
+    struct span *next;          // next span in avail list (or in free runs pool)
+    int index;                  // size class of blocks
+    bool in_avail;              // on owner's avail list for its class
+} span_t;
+_Static_assert(sizeof(span_t) <= SPAN_HEADER, "span_t must fit in SPAN_HEADER");
+
+struct threadheap {
+    span_t *avail[NCLASSES];    // spans with room, per size class
+    bool owned;                 // false once owning thread has exited
+    threadheap_t *next;         // all heaps, for adoption
+    void *remote __attribute__((aligned(CACHE_LINE))); // blocks freed by other threads
+};
+
+static pthread_mutex_t span_lock = PTHREAD_MUTEX_INITIALIZER;
+static span_t *free_runs;       // released runs of spans in address order, available for reuse
+static threadheap_t *heaps;     // every heap, owned or orphaned
+static char *meta, *meta_end;   // bump space for heap records
+static unsigned long generation; // bumped by th_init, heaps from older generations are gone
+
+static __thread threadheap_t *my_heap;
+static __thread unsigned long my_generation;
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+static inline size_t roundup(size_t sz, size_t mult)
+{
+    return (sz + mult-1) & ~(mult-1);
+}
+
+static inline span_t *span_for_block(void *ptr)
+{
+    return (span_t *)((uintptr_t)ptr & ~(uintptr_t)(SPAN_SIZE - 1));
+}
+
+// Size class index and block size for a small request
+static int size_class(size_t size, size_t *block_size)
+{
+    if (size <= SMALL_MAX) {
+        *block_size = size ? roundup(size, SMALL_STEP) : SMALL_STEP;
+        return *block_size/SMALL_STEP - 1;
+    }
+    int index = SMALL_MAX/SMALL_STEP;
+    for (*block_size = 2*SMALL_MAX; *block_size < size; *block_size *= 2)
+        index++;
+    return index;
+}
+
+// Takes a run of nspans spans, reusing a released run if one is large
+// enough (any excess goes back to the pool), else extending the segment.
+// Caller must hold span_lock.
+static span_t *take_spans(size_t nspans)
+{
+    for (span_t **p = &free_runs; *p != NULL; p = &(*p)->next) {
+        span_t *run = *p;
+        if (run->nspans == nspans) {
+            *p = run->next;
+            return run;
+        }
+        if (run->nspans > nspans) { // keep the tail in the pool
+            span_t *tail = (span_t *)((char *)run + nspans * SPAN_SIZE);
+            tail->nspans = run->nspans - nspans;
+            tail->next = run->next;
+            *p = tail;
+            run->nspans = nspans;
+            return run;
+        }
+    }
+    span_t *run = extend_heap_segment(nspans * SPAN_PAGES);
+    if (run != NULL) run->nspans = nspans;
+    return run;
+}
+
+// Thread exit: leave the heap for the next new thread to adopt
+static void release_heap(void *heap)
+{
+    pthread_mutex_lock(&span_lock);
+    if (my_generation == generation) // else heap was discarded by th_init
+        ((threadheap_t *)heap)->owned = false;
+    pthread_mutex_unlock(&span_lock);
+}
+
+static void make_exit_key(void)
+{
+    pthread_key_create(&exit_key, release_heap);
+}
+
+// Returns calling thread's heap, adopting an orphan or making a new one
+// on the first call from a thread (or the first since th_init).
+static threadheap_t *get_heap(void)
+{
+    threadheap_t *heap = my_heap;
+    if (heap != NULL && my_generation == generation) return heap;
+
+    pthread_once(&exit_once, make_exit_key);
+    pthread_mutex_lock(&span_lock);
+    for (heap = heaps; heap != NULL && heap->owned; heap = heap->next)
+        ;
+    if (heap == NULL) {
+        size_t sz = roundup(sizeof(threadheap_t), CACHE_LINE);
+        if (meta + sz > meta_end) {
+            span_t *span = take_spans(1);
+            if (span == NULL) {
+                pthread_mutex_unlock(&span_lock);
+                return NULL;
+            }
+            meta = (char *)span;
+            meta_end = meta + SPAN_SIZE;
+        }
+        heap = (threadheap_t *)meta;
+        meta += sz;
+        memset(heap, 0, sizeof(*heap));
+        heap->next = heaps;
+        heaps = heap;
+    }
+    heap->owned = true;
+    pthread_mutex_unlock(&span_lock);
+    pthread_setspecific(exit_key, heap);
+    my_heap = heap;
+    my_generation = generation;
+    return heap;
+}
+
+// Owner-side free of a block into its span
+static void local_free(threadheap_t *heap, span_t *span, void *ptr)
+{
+    *(void **)ptr = span->free;
+    span->free = ptr;
+    if (!span->in_avail) {
+        span->next = heap->avail[span->index];
+        heap->avail[span->index] = span;
+        span->in_avail = true;
+    }
+}
+
+// Takes every block queued by other threads and frees it locally
+static void drain_remote(threadheap_t *heap)
+{
+    void *ptr = __atomic_exchange_n(&heap->remote, NULL, __ATOMIC_ACQUIRE);
+    while (ptr != NULL) {
+        void *next = *(void **)ptr;
+        local_free(heap, span_for_block(ptr), ptr);
+        ptr = next;
+    }
+}
+
+static void *large_malloc(size_t size)
+{
+    size_t nspans = roundup(size + SPAN_HEADER, SPAN_SIZE) / SPAN_SIZE;
+    pthread_mutex_lock(&span_lock);
+    span_t *run = take_spans(nspans);
+    pthread_mutex_unlock(&span_lock);
+    if (run == NULL) return NULL;
+    run->owner = NULL;
+    run->block_size = run->nspans * SPAN_SIZE - SPAN_HEADER;
+    return (char *)run + SPAN_HEADER;
+}
+
+// Returns a run to the pool, which is kept in address order so that a run
+// can be merged with the free runs on either side of it
+static void large_free(span_t *run)
+{
+    pthread_mutex_lock(&span_lock);
+    span_t **p = &free_runs, *prev = NULL;
+    for (; *p != NULL && *p < run; p = &(*p)->next)
+        prev = *p;
+    run->next = *p;
+    *p = run;
+    if (run->next && (char *)run + run->nspans * SPAN_SIZE == (char *)run->next) {
+        run->nspans += run->next->nspans;
+        run->next = run->next->next;
+    }
+    if (prev && (char *)prev + prev->nspans * SPAN_SIZE == (char *)run) {
+        prev->nspans += run->nspans;
+        prev->next = run->next;
+    }
+    pthread_mutex_unlock(&span_lock);
+}
+
+bool th_init(void)
+{
+    pthread_mutex_lock(&span_lock);
+    void *start = init_heap_segment(0);
+    bool ok = start != NULL && (uintptr_t)start % SPAN_SIZE == 0; // masking needs aligned spans
+    free_runs = NULL;
+    heaps = NULL;
+    meta = meta_end = NULL;
+    generation++;   // every thread's cached heap is now stale
+    pthread_mutex_unlock(&span_lock);
+    return ok;
+}
+
+void *th_malloc(size_t size)
+{
+    if (size > LARGE_MIN) return large_malloc(size);
+
+    threadheap_t *heap = get_heap();
+    if (heap == NULL) return NULL;
+    if (__atomic_load_n(&heap->remote, __ATOMIC_RELAXED) != NULL)
+        drain_remote(heap);
+
+    size_t block_size;
+    int index = size_class(size, &block_size);
+    span_t *span;
+    while ((span = heap->avail[index]) != NULL) {
+        if (span->free != NULL) {
+            void *ptr = span->free;
+            span->free = *(void **)ptr;
+            return ptr;
+        }
+        if (span->bump + block_size <= span->end) {
+            void *ptr = span->bump;
+            span->bump += block_size;
+            return ptr;
+        }
+        heap->avail[index] = span->next;  // exhausted, back on list when a block is freed
+        span->in_avail = false;
+    }
+
+    pthread_mutex_lock(&span_lock);
+    span = take_spans(1);
+    pthread_mutex_unlock(&span_lock);
+    if (span == NULL) return NULL;
+    span->owner = heap;
+    span->block_size = block_size;
+    span->index = index;
+    span->free = NULL;
+    span->bump = (char *)span + SPAN_HEADER + block_size;
+    span->end = (char *)span + SPAN_SIZE;
+    span->in_avail = true;
+    span->next = heap->avail[index];
+    heap->avail[index] = span;
+    return (char *)span + SPAN_HEADER;
+}
+
+void th_free(void *ptr)
+{
+    if (ptr == NULL) return;
+    span_t *span = span_for_block(ptr);
+    threadheap_t *owner = span->owner;
+
+    if (owner == NULL) {
+        large_free(span);
+    } else if (owner == my_heap && my_generation == generation) {
+        local_free(owner, span, ptr);
+    } else { // push onto owner's remote queue
+        void *head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+        do {
+            *(void **)ptr = head;
+        } while (!__atomic_compare_exchange_n(&owner->remote, &head, ptr, true,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+}
+
+void *th_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) return th_malloc(size);
+    size_t old_size = span_for_block(ptr)->block_size;
+    if (size <= old_size && (old_size <= LARGE_MIN || size > LARGE_MIN))
+        return ptr; // still fits, and would not move between small and large
+    void *newptr = th_malloc(size);
+    if (newptr != NULL) {
+        memcpy(newptr, ptr, old_size < size ? old_size : size);
+        th_free(ptr);
+    }
+    return newptr;
+}
@@ -0,0 +1,32 @@
+/* File: threadheap.h
+ * ------------------
+ * Interface for the per-thread heap allocator. Each thread allocates from
+ * spans of pages that it owns, without taking any lock. A block freed by a
+ * thread other than its owner is handed back through the owner's remote
+ * free queue and recycled on the owner's next allocation. The functions
+ * mirror those of allocator.h and may be called from any thread.
+ */
+#ifndef _THREADHEAP_H
+#define _THREADHEAP_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+/* Function: th_init
+ * -----------------
+ * Resets to an empty heap, discarding all thread heaps. Takes over the
+ * heap segment, so it cannot be used alongside myinit/mymalloc. Must be
+ * called while no other thread is inside th_malloc/th_free/th_realloc.
+ */
+bool th_init(void);
+
+/* Function: th_malloc, th_realloc, th_free
+ * ----------------------------------------
+ * Thread-safe versions of malloc, realloc and free. A block may be freed
+ * or realloc'ed by any thread, not just the one that allocated it.
+ */
+void *th_malloc(size_t size);
+void *th_realloc(void *ptr, size_t size);
+void th_free(void *ptr);
+
+#endif
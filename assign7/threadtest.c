@@ -0,0 +1,181 @@
+/*
+ * File: threadtest.c
+ * ------------------
+ * Stress test for the per-thread heap allocator in threadheap.c. The script
+ * replay in alloctest runs on a single thread, so it never frees a block
+ * into another thread's remote queue nor leaves a heap behind for adoption.
+ * This program does both from several threads at once, and checks that no
+ * block is handed out twice and that freed blocks are recycled rather than
+ * leaked. Exits with status 0 if every check passed, 1 otherwise.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "segment.h"
+#include "threadheap.h"
+
+#define NTHREADS 4
+#define NROUNDS 200
+#define BATCH 256
+#define NORPHAN 1000
+
+static int failures;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Blocks handed from each thread to the next in the ring, one batch per thread
+static void *batches[NTHREADS][BATCH];
+static size_t batch_sizes[NTHREADS][BATCH];
+static pthread_barrier_t round_barrier;
+
+static void report_failure(const char *test, const char *what)
+{
+    pthread_mutex_lock(&report_lock);
+    printf("%s: %s. ##### PROBLEM HERE #####\n", test, what);
+    failures++;
+    pthread_mutex_unlock(&report_lock);
+}
+
+// Size of the i'th block of a batch, a mix of small size classes with the
+// occasional request large enough to get spans of its own. Every thread uses
+// the same sizes, so whichever heap a thread adopts has spans of the classes
+// it needs.
+static size_t block_size(int round, int i)
+{
+    if ((round + i) % 97 == 0) return 40000;
+    return 1 + (size_t)(round * 31 + i * 7) % 1024;
+}
+
+// Every byte of a block holds the low byte of its tag, so a block that is
+// handed out twice or overlaps another is caught when it is checked
+static void fill_block(void *ptr, size_t size, int tag)
+{
+    memset(ptr, tag & 0xff, size);
+}
+
+static bool check_block(const void *ptr, size_t size, int tag)
+{
+    for (size_t i = 0; i < size; i++)
+        if (((const unsigned char *)ptr)[i] != (tag & 0xff)) return false;
+    return true;
+}
+
+// Each round, a thread allocates a batch, then takes the batch of the thread
+// before it in the ring and frees it. Those are remote frees, and they land in
+// the owner's queue while the owner is itself allocating and draining it.
+static void *ring_worker(void *arg)
+{
+    int self = (int)(long)arg, prev = (self + NTHREADS - 1) % NTHREADS;
+    for (int round = 0; round < NROUNDS; round++) {
+        for (int i = 0; i < BATCH; i++) {
+            size_t size = block_size(round, i);
+            batches[self][i] = th_malloc(size);
+            batch_sizes[self][i] = size;
+            if (batches[self][i] == NULL) {
+                report_failure("Remote free", "th_malloc returned NULL");
+                batch_sizes[self][i] = 0;
+                continue;
+            }
+            fill_block(batches[self][i], size, self * BATCH + i);
+        }
+        pthread_barrier_wait(&round_barrier);   // every batch is ready
+        for (int i = 0; i < BATCH; i++) {
+            if (!check_block(batches[prev][i], batch_sizes[prev][i], prev * BATCH + i))
+                report_failure("Remote free", "block contents changed while allocated");
+            th_free(batches[prev][i]);
+        }
+        pthread_barrier_wait(&round_barrier);   // every batch is freed before the next is made
+    }
+    return NULL;
+}
+
+// Runs the ring of threads, then repeats it to check that the blocks freed
+// remotely in the first pass are reused by the second, so the heap stays
+// the same size
+static void test_remote_free(void)
+{
+    pthread_t threads[NTHREADS];
+
+    printf("Remote frees between %d threads.\n", NTHREADS);
+    th_init();
+    size_t heap_size = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        pthread_barrier_init(&round_barrier, NULL, NTHREADS);
+        for (int t = 0; t < NTHREADS; t++)
+            pthread_create(&threads[t], NULL, ring_worker, (void *)(long)t);
+        for (int t = 0; t < NTHREADS; t++)
+            pthread_join(threads[t], NULL);
+        pthread_barrier_destroy(&round_barrier);
+        if (pass == 0) heap_size = heap_segment_size();
+    }
+    if (heap_segment_size() != heap_size)
+        report_failure("Remote free", "heap grew on second pass, remotely freed blocks were not reused");
+}
+
+// Allocates blocks and exits while they are still in use, orphaning its heap
+static void *orphan_owner(void *arg)
+{
+    void **blocks = arg;
+    for (int i = 0; i < NORPHAN; i++) {
+        blocks[i] = th_malloc(64);
+        if (blocks[i] != NULL) fill_block(blocks[i], 64, i);
+    }
+    return NULL;
+}
+
+// Allocates as many blocks as the orphan's owner did, adopting its heap
+static void *orphan_adopter(void *arg)
+{
+    void **blocks = arg;
+    for (int i = 0; i < NORPHAN; i++)
+        blocks[i] = th_malloc(64);
+    return NULL;
+}
+
+static int cmp_ptr(const void *one, const void *two)
+{
+    const void *a = *(void *const *)one, *b = *(void *const *)two;
+    return (a > b) - (a < b);
+}
+
+// A thread exits leaving its blocks allocated, and the main thread frees
+// them into the orphaned heap's remote queue. A new thread must then adopt
+// that heap, queue included, and get the same blocks back without growing
+// the heap.
+static void test_orphan(void)
+{
+    static void *freed[NORPHAN], *reused[NORPHAN];
+    pthread_t thread;
+
+    printf("Adopting an orphaned heap.\n");
+    th_init();  // main thread's own heap is now stale, its frees are remote
+    pthread_create(&thread, NULL, orphan_owner, freed);
+    pthread_join(thread, NULL);
+    size_t heap_size = heap_segment_size();
+    for (int i = 0; i < NORPHAN; i++) {
+        if (freed[i] == NULL || !check_block(freed[i], 64, i))
+            report_failure("Orphan", "block lost or changed after owner exited");
+        th_free(freed[i]);
+    }
+    pthread_create(&thread, NULL, orphan_adopter, reused);
+    pthread_join(thread, NULL);
+
+    if (heap_segment_size() != heap_size)
+        report_failure("Orphan", "heap grew, orphaned heap was not adopted");
+    qsort(freed, NORPHAN, sizeof(freed[0]), cmp_ptr);
+    int nreused = 0;
+    for (int i = 0; i < NORPHAN; i++)
+        if (bsearch(&reused[i], freed, NORPHAN, sizeof(freed[0]), cmp_ptr)) nreused++;
+    if (nreused == 0)
+        report_failure("Orphan", "no block freed to the orphan's remote queue was reused");
+}
+
+int main(int argc, char *argv[])
+{
+    test_remote_free();
+    test_orphan();
+    if (failures == 0)
+        printf("All thread heap tests passed.\n");
+    return failures == 0 ? 0 : 1;
+}